@@ -0,0 +1,356 @@
+//============================================================================
+//                                  libcpp-util
+//                   A simple odds-n-ends library for C++11
+//
+//         Licensed under modified BSD license. See LICENSE for details.
+//============================================================================
+
+#ifndef LIBCPP_UTIL_ASYNC_QUEUE_H
+#define LIBCPP_UTIL_ASYNC_QUEUE_H
+
+#if !defined(__cpp_impl_coroutine)
+#error "async_queue.h needs C++20 coroutines"
+#endif
+
+#include "libcpp-util/fifo/concurrent_queue.h"
+#include "libcpp-util/smp/spinlock.h"
+#include "libcpp-util/smp/wait_policy.h"
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+namespace cpputil {
+
+// Resumes a coroutine right where it was woken, i.e. on whichever thread made
+// the element (or the room) it was waiting for available.
+struct inline_executor {
+	template <class F>
+	void submit(F&& f) {
+		f();
+	}
+};
+
+// A concurrent_queue for coroutines. co_await async_pop() and
+// co_await async_push(v) complete straight away when they can, and otherwise
+// suspend the coroutine rather than the thread it runs on. Each suspended
+// awaiter is its own node in an intrusive FIFO of waiters, so waiting costs
+// nothing beyond the coroutine frame.
+//
+// Whoever makes progress possible (a push for waiting consumers, a pop for
+// waiting producers) completes as many waiters as it can, in the order they
+// arrived, and hands them back to the executor they were started from:
+//
+//	std::optional<T> v = co_await q.async_pop(pool);
+//
+// resumes on pool (anything with submit(F), such as thread_pool). Without an
+// executor the coroutine is resumed inline by the thread that woke it.
+//
+// Elements pass through the queue even when someone is waiting, so FIFO order
+// is as for the AtomicPolicy of the underlying queue. The lock guarding the
+// waiter lists is only taken when somebody is, or is about to start, waiting.
+//
+// close() completes every waiter: async_pop() with an empty optional once the
+// queue is drained, and async_push() with false, leaving the value unpushed.
+template <typename T, size_t N, class AtomicPolicy = mpmc_discipline>
+class async_queue {
+public:
+	using queue_type =
+		concurrent_queue<T, N, AtomicPolicy, std::allocator<T>,
+			 spin_wait_policy>;
+
+private:
+	struct waiter {
+		waiter* next;
+		std::coroutine_handle<> handle;
+		void* executor;
+		void (*schedule)(void*, std::coroutine_handle<>);
+
+		template <class Executor>
+		waiter(Executor& ex)
+			: next(nullptr), executor(&ex),
+			  schedule([](void* e, std::coroutine_handle<> h) {
+				  static_cast<Executor*>(e)->submit(
+					  [h] { h.resume(); });
+			  }) {}
+	};
+
+	struct waiter_list {
+		waiter* head = nullptr;
+		waiter** tail = &head;
+
+		bool empty() const {
+			return !head;
+		}
+
+		void push(waiter* w) {
+			w->next = nullptr;
+			*tail = w;
+			tail = &w->next;
+		}
+
+		waiter* pop() {
+			waiter* w = head;
+			head = w->next;
+			if (!head)
+				tail = &head;
+			return w;
+		}
+	};
+
+	// Writes a popped element into an optional, so T needn't be default
+	// constructible.
+	struct optional_output {
+		std::optional<T>* slot;
+
+		optional_output& operator*() {
+			return *this;
+		}
+		optional_output& operator++() {
+			return *this;
+		}
+		optional_output operator++(int) {
+			return *this;
+		}
+		optional_output& operator=(T&& val) {
+			slot->emplace(std::move(val));
+			return *this;
+		}
+	};
+
+	queue_type queue;
+
+	// Waiter bookkeeping, only touched on the slow path.
+	alignas(cacheline_size) spinlock lock;
+	std::atomic_size_t waiting;
+	waiter_list poppers, pushers;
+
+	async_queue(const async_queue&) = delete;
+	async_queue& operator=(const async_queue&) = delete;
+
+	bool try_pop_into(std::optional<T>& slot) {
+		return queue.try_pop_bulk(optional_output{&slot}, 1);
+	}
+
+	// Pop for a consumer that has just turned up. Returns whether it's
+	// done, either with an element or because there will be no more.
+	bool pop_or_closed(std::optional<T>& slot) {
+		// Everything pushed before close() is there to be popped.
+		bool closed = is_closed();
+		if (try_pop_into(slot)) {
+			wake_waiters();
+			return true;
+		}
+		return closed;
+	}
+
+public:
+	class pop_awaiter;
+	class push_awaiter;
+
+private:
+	// Completes every waiter that can be completed. Called with lock held;
+	// the finished waiters are collected on done, to be resumed once it's
+	// dropped.
+	void settle(waiter_list& done);
+
+	void resume(waiter_list& done, waiter* self) {
+		while (!done.empty()) {
+			waiter* w = done.pop();
+			// w may be gone as soon as it's scheduled.
+			if (w != self)
+				w->schedule(w->executor, w->handle);
+		}
+	}
+
+	// A push or pop just changed the queue; complete anyone waiting for
+	// that. The fence pairs with the one in suspend(): either we see the
+	// waiter, or its recheck sees our change.
+	void wake_waiters() {
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (!waiting.load(std::memory_order_relaxed))
+			return;
+		waiter_list done;
+		{
+			std::lock_guard<spinlock> l(lock);
+			settle(done);
+		}
+		resume(done, nullptr);
+	}
+
+	// Queues w, then settles in case things changed since w's caller last
+	// looked. Returns whether w still has to wait.
+	bool suspend(waiter_list& list, waiter* w) {
+		waiter_list done;
+		bool self_done = false;
+		{
+			std::lock_guard<spinlock> l(lock);
+			list.push(w);
+			waiting.fetch_add(1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			settle(done);
+			for (waiter* d = done.head; d; d = d->next)
+				self_done |= d == w;
+		}
+		resume(done, w);
+		return !self_done;
+	}
+
+public:
+	using value_type = T;
+
+	class pop_awaiter : private waiter {
+		friend class async_queue;
+
+		async_queue& q;
+		std::optional<T> slot;
+
+	public:
+		template <class Executor>
+		pop_awaiter(async_queue& queue, Executor& ex)
+			: waiter(ex), q(queue) {}
+
+		bool await_ready() {
+			return q.pop_or_closed(slot);
+		}
+
+		bool await_suspend(std::coroutine_handle<> h) {
+			this->handle = h;
+			return q.suspend(q.poppers, this);
+		}
+
+		// Empty once the queue is closed and drained.
+		std::optional<T> await_resume() {
+			return std::move(slot);
+		}
+	};
+
+	class push_awaiter : private waiter {
+		friend class async_queue;
+
+		async_queue& q;
+		T val;
+		bool pushed;
+
+	public:
+		template <class Executor>
+		push_awaiter(async_queue& queue, Executor& ex, T&& v)
+			: waiter(ex), q(queue), val(std::move(v)),
+			  pushed(false) {}
+
+		bool await_ready() {
+			if (q.is_closed())
+				return true;
+			return pushed = q.try_push(std::move(val));
+		}
+
+		bool await_suspend(std::coroutine_handle<> h) {
+			this->handle = h;
+			return q.suspend(q.pushers, this);
+		}
+
+		// False if the queue was closed first.
+		bool await_resume() {
+			return pushed;
+		}
+	};
+
+	async_queue() : waiting(0) {}
+
+	bool is_closed() const {
+		return queue.is_closed();
+	}
+
+	void close() {
+		queue.close();
+		waiter_list done;
+		{
+			std::lock_guard<spinlock> l(lock);
+			settle(done);
+		}
+		resume(done, nullptr);
+	}
+
+	constexpr size_t capacity() const {
+		return N;
+	}
+
+	template <class... Args>
+	bool try_emplace(Args&&... args) {
+		if (!queue.try_emplace(std::forward<Args>(args)...))
+			return false;
+		wake_waiters();
+		return true;
+	}
+
+	bool try_push(const T& val) {
+		return try_emplace(val);
+	}
+
+	bool try_push(T&& val) {
+		return try_emplace(std::move(val));
+	}
+
+	bool try_pop(T& val) {
+		if (!queue.try_pop(val))
+			return false;
+		wake_waiters();
+		return true;
+	}
+
+	pop_awaiter async_pop() {
+		static inline_executor ex;
+		return pop_awaiter(*this, ex);
+	}
+
+	template <class Executor>
+	pop_awaiter async_pop(Executor& ex) {
+		return pop_awaiter(*this, ex);
+	}
+
+	push_awaiter async_push(T val) {
+		static inline_executor ex;
+		return push_awaiter(*this, ex, std::move(val));
+	}
+
+	template <class Executor>
+	push_awaiter async_push(T val, Executor& ex) {
+		return push_awaiter(*this, ex, std::move(val));
+	}
+};
+
+template <typename T, size_t N, class AtomicPolicy>
+void async_queue<T, N, AtomicPolicy>::settle(waiter_list& done) {
+	bool progress = true;
+	while (progress) {
+		progress = false;
+		while (!pushers.empty()) {
+			auto* p = static_cast<push_awaiter*>(pushers.head);
+			if (is_closed()) {
+				p->pushed = false;
+			} else if (queue.try_push(std::move(p->val))) {
+				p->pushed = true;
+			} else {
+				break;
+			}
+			done.push(pushers.pop());
+			waiting.fetch_sub(1, std::memory_order_relaxed);
+			progress = true;
+		}
+		while (!poppers.empty()) {
+			auto* p = static_cast<pop_awaiter*>(poppers.head);
+			bool closed = is_closed();
+			if (!try_pop_into(p->slot) && !closed)
+				break;
+			done.push(poppers.pop());
+			waiting.fetch_sub(1, std::memory_order_relaxed);
+			progress = true;
+		}
+	}
+}
+
+}
+#endif
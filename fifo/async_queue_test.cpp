@@ -0,0 +1,108 @@
+// Needs C++20, unlike the rest of the tests.
+#include "async_queue.h"
+#include "libcpp-util/smp/thread_pool.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+// Fire-and-forget coroutine.
+struct detached {
+	struct promise_type {
+		detached get_return_object() {
+			return {};
+		}
+		std::suspend_never initial_suspend() {
+			return {};
+		}
+		std::suspend_never final_suspend() noexcept {
+			return {};
+		}
+		void return_void() {}
+		void unhandled_exception() {
+			abort();
+		}
+	};
+};
+
+using queue = cpputil::async_queue<unsigned, 16>;
+
+detached consume(queue& q, std::vector<unsigned>& out) {
+	while (auto val = co_await q.async_pop())
+		out.push_back(*val);
+}
+
+// No threads: the consumer has to suspend and be resumed by the pushes.
+void inline_resume(unsigned count) {
+	queue q;
+	std::vector<unsigned> out;
+	consume(q, out);
+	for (unsigned i = 0; i < count; ++i) {
+		if (!q.try_push(i)) {
+			puts("Full with a waiting consumer");
+			abort();
+		}
+	}
+	q.close();
+	if (out.size() != count) {
+		puts("Lost elements");
+		abort();
+	}
+	for (unsigned i = 0; i < count; ++i) {
+		if (out[i] != i) {
+			puts("Out of order");
+			abort();
+		}
+	}
+}
+
+detached produce(queue& q, cpputil::thread_pool& pool, unsigned base,
+		 unsigned count, std::atomic_uint& live) {
+	for (unsigned i = 0; i < count; ++i) {
+		if (!co_await q.async_push(base + i, pool)) {
+			puts("Push failed");
+			abort();
+		}
+	}
+	if (--live == 0)
+		q.close();
+}
+
+detached consume_on(queue& q, cpputil::thread_pool& pool, unsigned count,
+		    std::vector<std::atomic_uint>& seen,
+		    std::atomic_uint& done) {
+	while (auto val = co_await q.async_pop(pool))
+		seen[*val % count]++;
+	++done;
+}
+
+// Many more coroutines than workers, all of them bouncing off a small queue.
+void on_pool(unsigned producers, unsigned consumers, unsigned count) {
+	cpputil::thread_pool pool(2);
+	queue q;
+	std::vector<std::atomic_uint> seen(count);
+	std::atomic_uint live(producers), done(0);
+
+	for (unsigned c = 0; c < consumers; ++c)
+		pool.submit([&] { consume_on(q, pool, count, seen, done); });
+	for (unsigned p = 0; p < producers; ++p)
+		pool.submit([&, p] { produce(q, pool, p * count, count, live); });
+	while (done != consumers)
+		std::this_thread::yield();
+
+	for (auto& s : seen) {
+		if (s != producers) {
+			puts("Lost or duplicated elements");
+			abort();
+		}
+	}
+}
+
+int main() {
+	puts("Inline");
+	inline_resume(1000);
+	puts("Thread pool");
+	on_pool(8, 8, 10000);
+	return 0;
+}
@@ -8,14 +8,20 @@
 #ifndef LIBCPP_UTIL_SPSC_CIRC_FIFO_H
 #define LIBCPP_UTIL_SPSC_CIRC_FIFO_H
 
+#include "libcpp-util/fifo/queue_stats.h"
 #include "libcpp-util/smp/semaphore.h"
+#include "libcpp-util/smp/spinlock.h"
+#include "libcpp-util/smp/wait_policy.h"
 #include "libcpp-util/util/raw_array.h"
 #include "libcpp-util/util/ref_count_handle.h"
 
+#include <algorithm>
 #include <atomic>
 #include <memory>
 #include <cassert>
 #include <cstddef>
+#include <iterator>
+#include <new>
 #include <type_traits>
 
 namespace cpputil {
@@ -34,19 +40,29 @@ public:
 	using head_index_type = atomic_t<MultiConsumer>;
 	using tail_index_type = atomic_t<MultiProducer>;
 
-	static std::size_t increment_index(nonatomic& index, unsigned N) {
-		std::size_t tmp = index;
-		index = (index + 1) % N;
-		return tmp;
+	// Indices are positions that count up forever; the slot for a position
+	// is pos % N. claim_index() tries to move the index from pos to pos + n
+	// and fails if another thread on the same side got there first, in
+	// which case pos is refreshed with the index's current value. A side
+	// with a single thread can never lose that race.
+	static std::size_t load_index(const nonatomic& index) {
+		return index;
 	}
 
-	static std::size_t increment_index(atomic& index, unsigned N) {
-		std::size_t old_count, new_count;
-		do {
-			old_count = index;
-			new_count = (old_count + 1) % N;
-		} while (!index.compare_exchange_strong(old_count, new_count));
-		return old_count;
+	static std::size_t load_index(const atomic& index) {
+		return index.load(std::memory_order_relaxed);
+	}
+
+	static bool claim_index(nonatomic& index, std::size_t& pos,
+				std::size_t n = 1) {
+		index = pos + n;
+		return true;
+	}
+
+	static bool claim_index(atomic& index, std::size_t& pos,
+				std::size_t n = 1) {
+		return index.compare_exchange_weak(pos, pos + n,
+						   std::memory_order_relaxed);
 	}
 };
 typedef atomic_discipline<false, false> spsc_discipline;
@@ -54,23 +70,47 @@ typedef atomic_discipline<true, false> mpsc_discipline;
 typedef atomic_discipline<false, true> spmc_discipline;
 typedef atomic_discipline<true, true> mpmc_discipline;
 
-// FIXME: This implementation is exception-unsafe. When an exception is thrown
-// while copying an object, a block of undefined bits is left there to be
-// consumed later by a pull operation. Instead check the relevant functions for
-// noexcept and don't release the lock until we have completed putting the item
-// in the queue. If an exception is thrown, decrement the index and rethrow.
+// Bounded queue after Dmitry Vyukov's MPMC ring. Every slot carries its own
+// sequence number, which is the only thing producers and consumers hand off
+// through: a slot whose sequence equals pos is free for the producer claiming
+// position pos, and one whose sequence equals pos + 1 holds the element for
+// the consumer claiming pos. Publishing an element or freeing a slot is a
+// single release store to that slot's sequence, so producers only contend
+// with other producers on tail (and consumers on head), and only when the
+// AtomicPolicy says there is more than one of them.
+//
+// try_push()/try_pop() never block. The blocking calls are layered on top and
+// only involve the WaitPolicy (see smp/wait_policy.h) when the ring is
+// actually full or empty, so the policy decides whether a blocked thread
+// sleeps, yields or spins. The StatsPolicy (see fifo/queue_stats.h) sees every
+// operation, wait and lost index race; the default one keeps nothing.
+//
+// FIXME: If constructing an element throws after its slot has been claimed,
+// the slot is never published and consumers will stall on it. We can't hand
+// the position back once another producer has claimed past it.
 template <typename T, size_t N, class AtomicPolicy,
-	  class Alloc = std::allocator<T>>
-class concurrent_queue : public AtomicPolicy {
+	  class Alloc = std::allocator<T>,
+	  class WaitPolicy = condvar_wait_policy,
+	  class StatsPolicy = no_queue_stats_policy>
+class concurrent_queue : public AtomicPolicy, private StatsPolicy {
 private:
-	std::atomic_bool open;
+	struct cell {
+		std::atomic_size_t sequence;
+		typename std::aligned_storage<sizeof(T),
+					      std::alignment_of<T>::value>::type
+			storage;
+
+		T& value() {
+			return reinterpret_cast<T&>(storage);
+		}
+	};
 
-	std::condition_variable empty_cv, full_cv;
-	std::mutex lock;
+	alignas(cacheline_size) typename AtomicPolicy::head_index_type head;
+	alignas(cacheline_size) typename AtomicPolicy::tail_index_type tail;
 
-	std::size_t full, empty;
-	typename AtomicPolicy::head_index_type head;
-	typename AtomicPolicy::tail_index_type tail;
+	// Slow path state, only touched when somebody waits.
+	alignas(cacheline_size) std::atomic_bool open;
+	WaitPolicy not_full, not_empty;
 
 	concurrent_queue(const concurrent_queue&) = delete;
 	concurrent_queue& operator=(const concurrent_queue&) = delete;
@@ -78,61 +118,168 @@ private:
 	concurrent_queue& operator=(concurrent_queue&&) = delete;
 
 	Alloc alloc;
-	raw_array<T, N> fifo;
+	using alloc_traits = std::allocator_traits<Alloc>;
+	cell fifo[N];
 
 	enum class wait_result {
 		ready,
 		closed
 	};
 
-	wait_result wait_for_used_space_or_close() {
-		std::unique_lock<std::mutex> l(lock);
+	static std::ptrdiff_t distance(std::size_t seq, std::size_t pos) {
+		return static_cast<std::ptrdiff_t>(seq - pos);
+	}
+
+	cell& cell_of(const T& slot) {
+		auto offset = reinterpret_cast<const char*>(&slot) -
+			      reinterpret_cast<const char*>(fifo);
+		return fifo[offset / sizeof(cell)];
+	}
+
+	// With no arguments a claimed slot is default-initialized, so a
+	// trivial T (a raw packet buffer, say) isn't zeroed only to be
+	// overwritten by the producer.
+	void construct_slot(T* slot) {
+		::new (static_cast<void*>(slot)) T;
+	}
+
+	template <class... Args>
+	void construct_slot(T* slot, Args&&... args) {
+		alloc_traits::construct(alloc, slot,
+					std::forward<Args>(args)...);
+	}
+
+	// A batch of n elements (or slots) can satisfy more than one waiter.
+	static void wake(WaitPolicy& waiters, std::size_t n) {
+		if (n > 1)
+			waiters.notify_all();
+		else
+			waiters.notify_one();
+	}
+
+	// Claim up to max consecutive slots starting at index with a single
+	// index update. Slots are ready for us when their sequence reads
+	// pos + lag: a lag of 0 finds free slots for producers, and a lag of 1
+	// finds published elements for consumers. Returns how many slots were
+	// claimed, starting at pos.
+	template <class Index>
+	std::size_t claim_run(Index& index, std::size_t lag, std::size_t& pos,
+			      std::size_t max) {
+		if (!max)
+			return 0;
+		pos = AtomicPolicy::load_index(index);
 		while (1) {
-			if (full)
-				return wait_result::ready;
-			else if (!open)
-				return wait_result::closed;
-			full_cv.wait(l);
+			std::size_t n = 0;
+			std::ptrdiff_t diff = 0;
+			while (n < max) {
+				std::size_t seq = fifo[(pos + n) % N].sequence.load(
+					std::memory_order_acquire);
+				diff = distance(seq, pos + n + lag);
+				if (diff)
+					break;
+				++n;
+			}
+			if (n) {
+				if (AtomicPolicy::claim_index(index, pos, n))
+					return n;
+			} else if (diff < 0) {
+				return 0; // Full or empty
+			} else {
+				pos = AtomicPolicy::load_index(index);
+			}
+			if (lag)
+				StatsPolicy::account_pop_retry();
+			else
+				StatsPolicy::account_push_retry();
 		}
 	}
 
+	// Producer side
+	bool claim_tail(std::size_t& pos) {
+		return claim_run(tail, 0, pos, 1);
+	}
+
+	void publish_tail(std::size_t pos, std::size_t n = 1) {
+		for (std::size_t i = 0; i < n; ++i)
+			fifo[(pos + i) % N].sequence.store(
+				pos + i + 1, std::memory_order_release);
+		StatsPolicy::account_push(n);
+		wake(not_empty, n);
+	}
+
+	bool has_empty_space() {
+		std::size_t pos = AtomicPolicy::load_index(tail);
+		std::size_t seq =
+			fifo[pos % N].sequence.load(std::memory_order_acquire);
+		// A sequence past pos means somebody beat us to it; report
+		// space so the caller goes around again.
+		return distance(seq, pos) >= 0;
+	}
+
 	void wait_for_empty_space() {
-		std::unique_lock<std::mutex> l(lock);
-		while (1) {
-			if (empty)
-				return;
-			empty_cv.wait(l);
-		}
+		StatsPolicy::timed_push_wait([&] {
+			not_full.wait([&] { return has_empty_space(); });
+		});
 	}
 
-	bool pop_value_common(T& val) {
-		auto tmp_head = AtomicPolicy::increment_index(head, N);
-		full--;
-		val = std::move(fifo[tmp_head]);
-		alloc.destroy(&fifo[tmp_head]);
-		empty++;
-		empty_cv.notify_one();
-		return true;
+	// Consumer side
+	bool claim_head(std::size_t& pos) {
+		return claim_run(head, 1, pos, 1);
+	}
+
+	void release_head(std::size_t pos, std::size_t n = 1) {
+		for (std::size_t i = 0; i < n; ++i)
+			fifo[(pos + i) % N].sequence.store(
+				pos + i + N, std::memory_order_release);
+		StatsPolicy::account_pop(n);
+		wake(not_full, n);
+	}
+
+	bool has_used_space() {
+		std::size_t pos = AtomicPolicy::load_index(head);
+		std::size_t seq =
+			fifo[pos % N].sequence.load(std::memory_order_acquire);
+		return distance(seq, pos + 1) >= 0;
+	}
+
+	wait_result wait_for_used_space_or_close() {
+		StatsPolicy::timed_pop_wait([&] {
+			not_empty.wait(
+				[&] { return has_used_space() || is_closed(); });
+		});
+		// Anything pushed before close() is still ours to drain.
+		return has_used_space() ? wait_result::ready
+					: wait_result::closed;
 	}
 
-	bool queue_is_finished() {
-		return is_closed() && full == 0;
+	template <class OutputIt>
+	OutputIt pop_values_common(std::size_t pos, std::size_t n, OutputIt out) {
+		for (std::size_t i = 0; i < n; ++i) {
+			T& elem = fifo[(pos + i) % N].value();
+			*out++ = std::move(elem);
+			alloc_traits::destroy(alloc, &elem);
+		}
+		release_head(pos, n);
+		return out;
 	}
 
 public:
 	using value_type = T;
 	using allocator_type = Alloc;
 
-	concurrent_queue() : open(true), full(0), empty(N), head(0), tail(0) {}
+	concurrent_queue() : head(0), tail(0), open(true) {
+		for (std::size_t i = 0; i < N; ++i)
+			fifo[i].sequence.store(i, std::memory_order_relaxed);
+	}
 	// TODO: Other standard library type constructors
 	~concurrent_queue() {
-		// XXX: We check if already closed because we don't want to signal
-		// everyone again as we're destroying things.
-		if (is_closed())
-			close();
-		while (head != tail) {
-			alloc.destroy(&fifo[head]);
-			head = (head + 1) % N;
+		std::size_t end = AtomicPolicy::load_index(tail);
+		for (std::size_t pos = AtomicPolicy::load_index(head); pos != end;
+		     ++pos) {
+			cell& c = fifo[pos % N];
+			// Skip anything that was claimed but never published.
+			if (c.sequence.load(std::memory_order_acquire) == pos + 1)
+				alloc_traits::destroy(alloc, &c.value());
 		}
 	}
 
@@ -142,57 +289,379 @@ public:
 
 	void close() {
 		open = false;
-		full_cv.notify_all(); // Make sure to wake any readers
+		not_empty.notify_all(); // Make sure to wake any readers
 	}
 
 	constexpr size_t capacity() const {
 		return N;
 	}
 
+	queue_stats stats() const {
+		return StatsPolicy::snapshot();
+	}
+
+	template <class... Args>
+	bool try_emplace(Args&&... args) {
+		std::size_t pos;
+		if (!claim_tail(pos))
+			return false;
+		alloc_traits::construct(alloc, &fifo[pos % N].value(),
+					std::forward<Args>(args)...);
+		publish_tail(pos);
+		return true;
+	}
+
 	template <class... Args>
 	void emplace(Args&&... args) {
-		wait_for_empty_space();
-		empty--;
-		auto tmp_tail = AtomicPolicy::increment_index(tail, N);
-		alloc.construct(&fifo[tmp_tail], std::forward<Args>(args)...);
-		full++;
-		full_cv.notify_one();
+		// Nothing is forwarded until a slot is claimed, so retrying
+		// can't see moved-from arguments.
+		while (!try_emplace(std::forward<Args>(args)...))
+			wait_for_empty_space();
 	}
 
 	void push(const T& val) {
-		wait_for_empty_space();
-		empty--;
-		auto tmp_tail = AtomicPolicy::increment_index(tail, N);
-		alloc.construct(&fifo[tmp_tail], val);
-		full++;
-		full_cv.notify_one();
+		emplace(val);
 	}
 
 	void push(T&& val) {
-		wait_for_empty_space();
-		empty--;
-		auto tmp_tail = AtomicPolicy::increment_index(tail, N);
-		alloc.construct(&fifo[tmp_tail], std::move(val));
-		full++;
-		full_cv.notify_one();
+		emplace(std::move(val));
 	}
 
 	bool try_push(const T& val) {
-		std::unique_lock<std::mutex> l(lock);
-		if (!empty)
+		return try_emplace(val);
+	}
+
+	bool try_push(T&& val) {
+		return try_emplace(std::move(val));
+	}
+
+	bool pop(T& val) {
+		while (!try_pop(val)) {
+			if (wait_for_used_space_or_close() == wait_result::closed)
+				return false;
+		}
+		return true;
+	}
+
+	bool try_pop(T& val) {
+		std::size_t pos;
+		if (!claim_head(pos))
+			return false;
+		pop_values_common(pos, 1, &val);
+		return true;
+	}
+
+	// Bulk operations claim a whole run of slots with one index update and
+	// wake sleepers once per run rather than once per element.
+
+	// Copies as much of [first, last) as fits right now and returns the
+	// first element that wasn't pushed.
+	template <class ForwardIt>
+	ForwardIt try_push_bulk(ForwardIt first, ForwardIt last) {
+		std::size_t pos;
+		std::size_t n = claim_run(tail, 0, pos, std::distance(first, last));
+		for (std::size_t i = 0; i < n; ++i, ++first)
+			alloc_traits::construct(
+				alloc, &fifo[(pos + i) % N].value(), *first);
+		if (n)
+			publish_tail(pos, n);
+		return first;
+	}
+
+	template <class ForwardIt>
+	void push_bulk(ForwardIt first, ForwardIt last) {
+		while ((first = try_push_bulk(first, last)) != last)
+			wait_for_empty_space();
+	}
+
+	// Moves up to max elements to out and returns how many there were.
+	template <class OutputIt>
+	std::size_t try_pop_bulk(OutputIt out, std::size_t max) {
+		std::size_t pos;
+		std::size_t n = claim_run(head, 1, pos, max);
+		if (n)
+			pop_values_common(pos, n, out);
+		return n;
+	}
+
+	// Waits for at least one element, then behaves like try_pop_bulk().
+	// Returns 0 once the queue is closed and drained.
+	template <class OutputIt>
+	std::size_t pop_bulk(OutputIt out, std::size_t max) {
+		std::size_t n;
+		if (!max)
+			return 0;
+		while (!(n = try_pop_bulk(out, max))) {
+			if (wait_for_used_space_or_close() == wait_result::closed)
+				return 0;
+		}
+		return n;
+	}
+
+	// Two-phase access to the ring's storage, for elements too big to
+	// copy around. claim() constructs an element in a free slot and hands
+	// it to the producer to fill in; consumers can't see it until it is
+	// passed to publish(). peek() hands a consumer the next element in
+	// place, and its slot isn't reused until it is passed to release().
+	// Every claim() needs exactly one publish() and every peek() one
+	// release(). claim() and peek() move the shared index on, so any
+	// number of slots can be outstanding at once, from one thread or
+	// several, and they can be published or released in any order. Each
+	// one holds up the ring behind it, though: consumers can't get past a
+	// slot that is claimed but not published, nor producers past one that
+	// is peeked but not released, so a thread that keeps slots while it
+	// blocks waiting for more can deadlock. (The SPSC specialization is
+	// stricter; see there.)
+	template <class... Args>
+	T* try_claim(Args&&... args) {
+		std::size_t pos;
+		if (!claim_tail(pos))
+			return nullptr;
+		T* slot = &fifo[pos % N].value();
+		construct_slot(slot, std::forward<Args>(args)...);
+		return slot;
+	}
+
+	template <class... Args>
+	T& claim(Args&&... args) {
+		std::size_t pos;
+		while (!claim_tail(pos))
+			wait_for_empty_space();
+		T* slot = &fifo[pos % N].value();
+		construct_slot(slot, std::forward<Args>(args)...);
+		return *slot;
+	}
+
+	void publish(T& slot) {
+		// A claimed slot's sequence still reads the position it was
+		// claimed at.
+		cell& c = cell_of(slot);
+		publish_tail(c.sequence.load(std::memory_order_relaxed));
+	}
+
+	const T* try_peek() {
+		std::size_t pos;
+		if (!claim_head(pos))
+			return nullptr;
+		return &fifo[pos % N].value();
+	}
+
+	// Returns nullptr once the queue is closed and drained.
+	const T* peek() {
+		std::size_t pos;
+		while (!claim_head(pos)) {
+			if (wait_for_used_space_or_close() == wait_result::closed)
+				return nullptr;
+		}
+		return &fifo[pos % N].value();
+	}
+
+	void release(const T& slot) {
+		cell& c = cell_of(slot);
+		alloc_traits::destroy(alloc, &c.value());
+		release_head(c.sequence.load(std::memory_order_relaxed) - 1);
+	}
+};
+
+// Single-producer/single-consumer specialization. Each index has exactly one
+// writer, so there is no need for a lock or CAS on the fast path: the producer
+// publishes an element by storing tail with release semantics and the consumer
+// frees a slot by storing head the same way. The indices count up forever and
+// are only reduced modulo N to find a slot, so head == tail is empty and
+// tail - head == N is full without burning a slot.
+//
+// Each side also keeps a private copy of the other side's index, and only
+// reloads it (pulling the other side's cacheline over) when the cached value
+// says the queue is empty or full. The WaitPolicy only blocks when a side
+// actually has to wait, but every push and pop still tells it, in case the
+// other side is asleep. With a sleeping policy, including the default
+// condvar_wait_policy, that is a seq_cst fence and a load per operation, which
+// is the price of never missing a wakeup; with spin_wait_policy or
+// yield_wait_policy it is nothing, and the fast path is acquire/release only.
+template <typename T, size_t N, class Alloc, class WaitPolicy,
+	  class StatsPolicy>
+class concurrent_queue<T, N, spsc_discipline, Alloc, WaitPolicy, StatsPolicy>
+	: public spsc_discipline, private StatsPolicy {
+private:
+	// Consumer-owned.
+	alignas(cacheline_size) std::atomic_size_t head;
+	std::size_t cached_tail;
+
+	// Producer-owned.
+	alignas(cacheline_size) std::atomic_size_t tail;
+	std::size_t cached_head;
+
+	// Slow path state, only touched when somebody waits.
+	alignas(cacheline_size) std::atomic_bool open;
+	WaitPolicy not_full, not_empty;
+
+	concurrent_queue(const concurrent_queue&) = delete;
+	concurrent_queue& operator=(const concurrent_queue&) = delete;
+	concurrent_queue(concurrent_queue&&) = delete;
+	concurrent_queue& operator=(concurrent_queue&&) = delete;
+
+	Alloc alloc;
+	using alloc_traits = std::allocator_traits<Alloc>;
+	raw_array<T, N> fifo;
+
+	enum class wait_result {
+		ready,
+		closed
+	};
+
+	// Producer side
+	std::size_t empty_space(std::size_t pos, std::size_t want) {
+		std::size_t n = N - (pos - cached_head);
+		if (n >= want)
+			return n;
+		cached_head = head.load(std::memory_order_acquire);
+		return N - (pos - cached_head);
+	}
+
+	bool has_empty_space(std::size_t pos) {
+		return empty_space(pos, 1) != 0;
+	}
+
+	// Only counts as a wait if there's no room already.
+	std::size_t wait_for_empty_space() {
+		std::size_t pos = tail.load(std::memory_order_relaxed);
+		if (has_empty_space(pos))
+			return pos;
+		StatsPolicy::timed_push_wait([&] {
+			not_full.wait([&] { return has_empty_space(pos); });
+		});
+		return pos;
+	}
+
+	void publish_tail(std::size_t pos, std::size_t n = 1) {
+		tail.store(pos + n, std::memory_order_release);
+		StatsPolicy::account_push(n);
+		not_empty.notify_one();
+	}
+
+	// Consumer side
+	std::size_t used_space(std::size_t pos, std::size_t want) {
+		std::size_t n = cached_tail - pos;
+		if (n >= want)
+			return n;
+		cached_tail = tail.load(std::memory_order_acquire);
+		return cached_tail - pos;
+	}
+
+	bool has_used_space(std::size_t pos) {
+		return used_space(pos, 1) != 0;
+	}
+
+	void construct_slot(T* slot) {
+		::new (static_cast<void*>(slot)) T;
+	}
+
+	template <class... Args>
+	void construct_slot(T* slot, Args&&... args) {
+		alloc_traits::construct(alloc, slot,
+					std::forward<Args>(args)...);
+	}
+
+	wait_result wait_for_used_space_or_close(std::size_t pos) {
+		if (has_used_space(pos))
+			return wait_result::ready;
+		StatsPolicy::timed_pop_wait([&] {
+			not_empty.wait([&] {
+				return has_used_space(pos) || is_closed();
+			});
+		});
+		// Anything pushed before close() is still ours to drain.
+		return has_used_space(pos) ? wait_result::ready
+					   : wait_result::closed;
+	}
+
+	void release_head(std::size_t pos, std::size_t n = 1) {
+		head.store(pos + n, std::memory_order_release);
+		StatsPolicy::account_pop(n);
+		not_full.notify_one();
+	}
+
+	template <class OutputIt>
+	OutputIt pop_values_common(std::size_t pos, std::size_t n, OutputIt out) {
+		for (std::size_t i = 0; i < n; ++i) {
+			T& elem = fifo[(pos + i) % N];
+			*out++ = std::move(elem);
+			alloc_traits::destroy(alloc, &elem);
+		}
+		release_head(pos, n);
+		return out;
+	}
+
+public:
+	using value_type = T;
+	using allocator_type = Alloc;
+
+	concurrent_queue()
+		: head(0), cached_tail(0), tail(0), cached_head(0), open(true) {}
+	~concurrent_queue() {
+		std::size_t end = tail.load(std::memory_order_acquire);
+		for (std::size_t i = head.load(); i != end; ++i)
+			alloc_traits::destroy(alloc, &fifo[i % N]);
+	}
+
+	bool is_closed() const {
+		return !open;
+	}
+
+	void close() {
+		open = false;
+		not_empty.notify_all(); // Make sure to wake any readers
+	}
+
+	constexpr size_t capacity() const {
+		return N;
+	}
+
+	queue_stats stats() const {
+		return StatsPolicy::snapshot();
+	}
+
+	template <class... Args>
+	void emplace(Args&&... args) {
+		std::size_t pos = wait_for_empty_space();
+		alloc_traits::construct(alloc, &fifo[pos % N],
+					std::forward<Args>(args)...);
+		publish_tail(pos);
+	}
+
+	void push(const T& val) {
+		emplace(val);
+	}
+
+	void push(T&& val) {
+		emplace(std::move(val));
+	}
+
+	template <class... Args>
+	bool try_emplace(Args&&... args) {
+		std::size_t pos = tail.load(std::memory_order_relaxed);
+		if (!has_empty_space(pos))
 			return false;
-		empty--;
-		auto tmp_tail = AtomicPolicy::increment_index(tail, N);
-		l.unlock();
-		alloc.construct(&fifo[tmp_tail], val);
-		full++;
-		full_cv.notify_one();
+		alloc_traits::construct(alloc, &fifo[pos % N],
+					std::forward<Args>(args)...);
+		publish_tail(pos);
+		return true;
+	}
+
+	bool try_push(const T& val) {
+		return try_emplace(val);
+	}
+
+	bool try_push(T&& val) {
+		return try_emplace(std::move(val));
 	}
 
 	bool pop(T& val) {
-		switch (wait_for_used_space_or_close()) {
+		std::size_t pos = head.load(std::memory_order_relaxed);
+		switch (wait_for_used_space_or_close(pos)) {
 		case wait_result::ready:
-			return pop_value_common(val);
+			pop_values_common(pos, 1, &val);
+			return true;
 		case wait_result::closed:
 			return false;
 		}
@@ -200,24 +669,129 @@ public:
 	}
 
 	bool try_pop(T& val) {
-		std::unique_lock<std::mutex> l(lock);
-		if (!full)
-			return false;
-		if (queue_is_finished())
+		std::size_t pos = head.load(std::memory_order_relaxed);
+		if (!has_used_space(pos))
 			return false;
-		l.unlock();
-		return pop_value_common(val);
+		pop_values_common(pos, 1, &val);
+		return true;
+	}
+
+	// Bulk operations publish a whole run with one index store and at most
+	// one wakeup.
+
+	// Copies as much of [first, last) as fits right now and returns the
+	// first element that wasn't pushed.
+	template <class ForwardIt>
+	ForwardIt try_push_bulk(ForwardIt first, ForwardIt last) {
+		std::size_t pos = tail.load(std::memory_order_relaxed);
+		std::size_t want = std::distance(first, last);
+		std::size_t n = std::min(want, empty_space(pos, want));
+		for (std::size_t i = 0; i < n; ++i, ++first)
+			alloc_traits::construct(alloc, &fifo[(pos + i) % N],
+						*first);
+		if (n)
+			publish_tail(pos, n);
+		return first;
+	}
+
+	template <class ForwardIt>
+	void push_bulk(ForwardIt first, ForwardIt last) {
+		while ((first = try_push_bulk(first, last)) != last)
+			wait_for_empty_space();
+	}
+
+	// Moves up to max elements to out and returns how many there were.
+	template <class OutputIt>
+	std::size_t try_pop_bulk(OutputIt out, std::size_t max) {
+		std::size_t pos = head.load(std::memory_order_relaxed);
+		std::size_t n = std::min(max, used_space(pos, max));
+		if (n)
+			pop_values_common(pos, n, out);
+		return n;
+	}
+
+	// Waits for at least one element, then behaves like try_pop_bulk().
+	// Returns 0 once the queue is closed and drained.
+	template <class OutputIt>
+	std::size_t pop_bulk(OutputIt out, std::size_t max) {
+		std::size_t pos = head.load(std::memory_order_relaxed);
+		if (!max || wait_for_used_space_or_close(pos) ==
+				    wait_result::closed)
+			return 0;
+		return try_pop_bulk(out, max);
+	}
+
+	// Two-phase access, as in the general queue. Neither claim() nor
+	// peek() moves an index, so the producer has to publish() its slot
+	// before claiming (or pushing) again, and the consumer has to
+	// release() before peeking (or popping) again.
+	template <class... Args>
+	T* try_claim(Args&&... args) {
+		std::size_t pos = tail.load(std::memory_order_relaxed);
+		if (!has_empty_space(pos))
+			return nullptr;
+		T* slot = &fifo[pos % N];
+		construct_slot(slot, std::forward<Args>(args)...);
+		return slot;
+	}
+
+	template <class... Args>
+	T& claim(Args&&... args) {
+		T* slot = &fifo[wait_for_empty_space() % N];
+		construct_slot(slot, std::forward<Args>(args)...);
+		return *slot;
+	}
+
+	void publish(T& slot) {
+		std::size_t pos = tail.load(std::memory_order_relaxed);
+		assert(&slot == &fifo[pos % N] && "Publishing unclaimed slot");
+		(void)slot;
+		publish_tail(pos);
+	}
+
+	const T* try_peek() {
+		std::size_t pos = head.load(std::memory_order_relaxed);
+		if (!has_used_space(pos))
+			return nullptr;
+		return &fifo[pos % N];
+	}
+
+	// Returns nullptr once the queue is closed and drained.
+	const T* peek() {
+		std::size_t pos = head.load(std::memory_order_relaxed);
+		if (wait_for_used_space_or_close(pos) == wait_result::closed)
+			return nullptr;
+		return &fifo[pos % N];
+	}
+
+	void release(const T& slot) {
+		std::size_t pos = head.load(std::memory_order_relaxed);
+		assert(&slot == &fifo[pos % N] && "Releasing unpeeked slot");
+		alloc_traits::destroy(alloc, &slot);
+		release_head(pos);
 	}
 };
 
-template <typename T, unsigned N>
-using spsc_queue = concurrent_queue<T, N, spsc_discipline>;
-template <typename T, unsigned N>
-using spmc_queue = concurrent_queue<T, N, spmc_discipline>;
-template <typename T, unsigned N>
-using mpsc_queue = concurrent_queue<T, N, mpsc_discipline>;
-template <typename T, unsigned N>
-using mpmc_queue = concurrent_queue<T, N, mpmc_discipline>;
+template <typename T, unsigned N, class WaitPolicy = condvar_wait_policy,
+	  class StatsPolicy = no_queue_stats_policy>
+using spsc_queue =
+	concurrent_queue<T, N, spsc_discipline, std::allocator<T>,
+			 WaitPolicy, StatsPolicy>;
+template <typename T, unsigned N, class WaitPolicy = condvar_wait_policy,
+	  class StatsPolicy = no_queue_stats_policy>
+using spmc_queue =
+	concurrent_queue<T, N, spmc_discipline, std::allocator<T>,
+			 WaitPolicy, StatsPolicy>;
+template <typename T, unsigned N, class WaitPolicy = condvar_wait_policy,
+	  class StatsPolicy = no_queue_stats_policy>
+using mpsc_queue =
+	concurrent_queue<T, N, mpsc_discipline, std::allocator<T>,
+			 WaitPolicy, StatsPolicy>;
+template <typename T, unsigned N, class WaitPolicy = condvar_wait_policy,
+	  class StatsPolicy = no_queue_stats_policy>
+using mpmc_queue =
+	concurrent_queue<T, N, mpmc_discipline, std::allocator<T>,
+			 WaitPolicy, StatsPolicy>;
 
 } // End namespace
 #endif
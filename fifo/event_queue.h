@@ -0,0 +1,253 @@
+//============================================================================
+//                                  libcpp-util
+//                   A simple odds-n-ends library for C++11
+//
+//         Licensed under modified BSD license. See LICENSE for details.
+//============================================================================
+
+#ifndef LIBCPP_UTIL_EVENT_QUEUE_H
+#define LIBCPP_UTIL_EVENT_QUEUE_H
+
+#include "libcpp-util/fifo/concurrent_queue.h"
+#include "libcpp-util/smp/wait_policy.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <system_error>
+#include <utility>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace cpputil {
+
+// A concurrent_queue whose consumer lives in an event loop rather than
+// blocking in pop(). The queue owns an eventfd that becomes readable when
+// elements arrive in an empty queue; register file_descriptor() with
+// epoll/poll/select and call drain() when it fires.
+//
+// The eventfd is only written on the empty -> non-empty transition as seen by
+// the consumer: drain() arms the queue once it has emptied it, and the first
+// producer to push after that disarms it and writes the eventfd. Everyone
+// else pushing before the next drain() skips the syscall entirely, so a burst
+// of elements costs one wakeup.
+//
+// drain() is edge-triggered: if it returns max, there may be more and it has
+// to be called again before going back to the event loop. Close the queue to
+// wake the consumer one last time; it is done once is_closed() and drain()
+// comes back empty. Producers still block in push() when the queue is full,
+// through WaitPolicy.
+//
+// Linux only. The constructor throws std::system_error if no eventfd can be
+// had.
+template <typename T, size_t N, class AtomicPolicy = mpsc_discipline,
+	  class WaitPolicy = futex_wait_policy<>>
+class event_queue {
+public:
+	using queue_type = concurrent_queue<T, N, AtomicPolicy,
+					    std::allocator<T>, WaitPolicy>;
+
+private:
+	queue_type queue;
+	int fd;
+	alignas(cacheline_size) std::atomic_bool armed;
+
+	event_queue(const event_queue&) = delete;
+	event_queue& operator=(const event_queue&) = delete;
+
+	void signal() {
+		// Pairs with the fence in drain(): either we see armed, or the
+		// consumer's recheck sees what we just published.
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (armed.load(std::memory_order_relaxed) &&
+		    armed.exchange(false, std::memory_order_relaxed)) {
+			std::uint64_t one = 1;
+			ssize_t ret;
+			do {
+				ret = write(fd, &one, sizeof(one));
+			} while (ret == -1 && errno == EINTR);
+		}
+	}
+
+	// Output iterator that advances the caller's iterator, so successive
+	// try_pop_bulk() calls append instead of starting over.
+	template <class OutputIt>
+	struct output_ref {
+		OutputIt* it;
+
+		output_ref& operator*() {
+			return *this;
+		}
+		output_ref& operator++() {
+			return *this;
+		}
+		output_ref operator++(int) {
+			return *this;
+		}
+		output_ref& operator=(T&& val) {
+			*(*it)++ = std::move(val);
+			return *this;
+		}
+	};
+
+	void clear_event() {
+		std::uint64_t count;
+		ssize_t ret;
+		do {
+			ret = read(fd, &count, sizeof(count));
+		} while (ret == -1 && errno == EINTR);
+	}
+
+public:
+	event_queue() : armed(true) {
+		fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (fd == -1)
+			throw std::system_error(errno, std::system_category(),
+						"eventfd");
+	}
+
+	~event_queue() {
+		::close(fd);
+	}
+
+	int file_descriptor() const {
+		return fd;
+	}
+
+	bool is_closed() const {
+		return queue.is_closed();
+	}
+
+	// Also wakes the consumer, armed or not.
+	void close() {
+		queue.close();
+		armed.store(false, std::memory_order_relaxed);
+		std::uint64_t one = 1;
+		ssize_t ret;
+		do {
+			ret = write(fd, &one, sizeof(one));
+		} while (ret == -1 && errno == EINTR);
+	}
+
+	constexpr size_t capacity() const {
+		return N;
+	}
+
+	queue_stats stats() const {
+		return queue.stats();
+	}
+
+	template <class... Args>
+	void emplace(Args&&... args) {
+		queue.emplace(std::forward<Args>(args)...);
+		signal();
+	}
+
+	void push(const T& val) {
+		emplace(val);
+	}
+
+	void push(T&& val) {
+		emplace(std::move(val));
+	}
+
+	template <class... Args>
+	bool try_emplace(Args&&... args) {
+		if (!queue.try_emplace(std::forward<Args>(args)...))
+			return false;
+		signal();
+		return true;
+	}
+
+	bool try_push(const T& val) {
+		return try_emplace(val);
+	}
+
+	bool try_push(T&& val) {
+		return try_emplace(std::move(val));
+	}
+
+	template <class ForwardIt>
+	ForwardIt try_push_bulk(ForwardIt first, ForwardIt last) {
+		ForwardIt rest = queue.try_push_bulk(first, last);
+		if (rest != first)
+			signal();
+		return rest;
+	}
+
+	// Signals once the whole range is in, so a consumer isn't woken
+	// repeatedly for one batch. Producers blocked on a full queue rely on
+	// the consumer to make room, so it's woken whenever we'd have to wait.
+	template <class ForwardIt>
+	void push_bulk(ForwardIt first, ForwardIt last) {
+		while (first != last) {
+			ForwardIt rest = queue.try_push_bulk(first, last);
+			if (rest == first) {
+				signal();
+				queue.push(*first);
+				++rest;
+			}
+			first = rest;
+		}
+		signal();
+	}
+
+	// Consumer only. Pops up to max elements into out and returns how many.
+	// Returning less than max means the queue was seen empty and is armed
+	// again, so the next push makes the eventfd readable.
+	template <class OutputIt>
+	std::size_t drain(OutputIt out, std::size_t max) {
+		clear_event();
+		std::size_t n = 0;
+		while (n < max) {
+			std::size_t got = queue.try_pop_bulk(
+				output_ref<OutputIt>{&out}, max - n);
+			n += got;
+			if (n == max)
+				break;
+			if (!got) {
+				armed.store(true, std::memory_order_relaxed);
+				std::atomic_thread_fence(
+					std::memory_order_seq_cst);
+				got = queue.try_pop_bulk(
+					output_ref<OutputIt>{&out}, max - n);
+				if (!got)
+					break;
+				n += got;
+				// Something slipped in; keep going
+				// unarmed. If a producer beat us to the
+				// disarm, the eventfd just fires
+				// spuriously.
+				armed.store(false, std::memory_order_relaxed);
+			}
+		}
+		return n;
+	}
+
+	// Consumer only. Like drain(), but hands each element to f instead.
+	template <class F>
+	std::size_t drain_with(F&& f, std::size_t max) {
+		struct sink {
+			F& f;
+			sink& operator*() {
+				return *this;
+			}
+			sink& operator++() {
+				return *this;
+			}
+			sink& operator++(int) {
+				return *this;
+			}
+			sink& operator=(T&& val) {
+				f(std::move(val));
+				return *this;
+			}
+		};
+		return drain(sink{f}, max);
+	}
+};
+
+}
+#endif
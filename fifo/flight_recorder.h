@@ -0,0 +1,120 @@
+//============================================================================
+//                                  libcpp-util
+//                   A simple odds-n-ends library for C++11
+//
+//         Licensed under modified BSD license. See LICENSE for details.
+//============================================================================
+
+#ifndef LIBCPP_UTIL_FLIGHT_RECORDER_H
+#define LIBCPP_UTIL_FLIGHT_RECORDER_H
+
+#include "libcpp-util/smp/atomic_words.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+namespace cpputil {
+
+// Keeps the last N entries written to it, overwriting the oldest. There is a
+// single writer, which never waits and never allocates; anyone else can take
+// a snapshot of the recent history at any time while it keeps going, from a
+// crash handler if need be. Typically every thread has one of its own.
+//
+// Every slot is guarded by a sequence number in the style of a seqlock: odd
+// while the writer is filling it in, and then even and unique to the entry.
+// A reader copies a slot out and only keeps the copy if the sequence number
+// was the one it expected both before and after, so a torn entry, or one
+// overwritten mid-copy, is dropped rather than returned half-written.
+//
+// Entries are stored as atomic_words, so T has to be trivially copyable.
+template <typename T, size_t N>
+class flight_recorder {
+	static_assert(std::is_trivially_copyable<T>::value,
+		      "flight_recorder entries must be trivially copyable");
+	static_assert(N > 0, "flight_recorder needs at least one slot");
+
+private:
+	using word = std::uint64_t;
+
+	struct slot {
+		std::atomic<word> sequence;
+		atomic_words<T> data;
+	};
+
+	// Entries written so far; only the writer changes it.
+	std::atomic<word> head;
+	slot ring[N];
+
+	flight_recorder(const flight_recorder&) = delete;
+	flight_recorder& operator=(const flight_recorder&) = delete;
+
+	// Sequence number of the entry at pos once it's complete.
+	static word done(word pos) {
+		return 2 * pos + 2;
+	}
+
+public:
+	using value_type = T;
+
+	flight_recorder() : head(0) {
+		// No slot starts out complete for any position.
+		for (auto& s : ring)
+			s.sequence.store(1, std::memory_order_relaxed);
+	}
+
+	constexpr size_t capacity() const {
+		return N;
+	}
+
+	// Everything ever written, including what has been overwritten since.
+	word recorded() const {
+		return head.load(std::memory_order_relaxed);
+	}
+
+	// Writer only.
+	void push(const T& val) {
+		word pos = head.load(std::memory_order_relaxed);
+		slot& s = ring[pos % N];
+		s.sequence.store(done(pos) - 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		s.data.store(val);
+		s.sequence.store(done(pos), std::memory_order_release);
+		head.store(pos + 1, std::memory_order_release);
+	}
+
+	template <class... Args>
+	void emplace(Args&&... args) {
+		push(T(std::forward<Args>(args)...));
+	}
+
+	// Copies the entries still in the ring to out, oldest first, and
+	// returns how many there were. Anything the writer overwrites or is
+	// halfway through while we look is left out. Doesn't allocate, so a
+	// signal handler can call it with somewhere static to put the entries.
+	template <class OutputIt>
+	size_t snapshot(OutputIt out) const {
+		word end = head.load(std::memory_order_acquire);
+		word begin = end > N ? end - N : 0;
+		size_t n = 0;
+		for (word pos = begin; pos != end; ++pos) {
+			const slot& s = ring[pos % N];
+			if (s.sequence.load(std::memory_order_acquire) !=
+			    done(pos))
+				continue;
+			T val = s.data.load();
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (s.sequence.load(std::memory_order_relaxed) !=
+			    done(pos))
+				continue;
+			*out++ = val;
+			++n;
+		}
+		return n;
+	}
+};
+
+}
+#endif
@@ -0,0 +1,183 @@
+//============================================================================
+//                                  libcpp-util
+//                   A simple odds-n-ends library for C++11
+//
+//         Licensed under modified BSD license. See LICENSE for details.
+//============================================================================
+
+#ifndef LIBCPP_UTIL_MIRRORED_RING_H
+#define LIBCPP_UTIL_MIRRORED_RING_H
+
+#include "libcpp-util/cxx14/array_ref.h"
+#include "libcpp-util/fifo/ring_buffer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace cpputil {
+
+// Unsynchronized ring whose storage is mapped twice, back to back, so the
+// byte after the last one is the first one again. Whatever is in the ring,
+// and whatever room is left, is always a single contiguous run: a parser can
+// work on a message in place however it sits in the ring, and views into
+// readable() stay good until the elements under them are consumed.
+//
+// The storage is a memfd mapped into a reserved window of twice its size, so
+// the capacity is rounded up to a whole number of pages. Linux only; setting
+// up the mappings throws std::system_error when it fails.
+template <typename T = char>
+class mirrored_ring {
+	static_assert(std::is_trivially_copyable<T>::value,
+		      "mirrored_ring elements must be trivially copyable");
+
+private:
+	T* base;
+	size_t cap;
+	size_t head, count;
+
+	mirrored_ring(const mirrored_ring&) = delete;
+	mirrored_ring& operator=(const mirrored_ring&) = delete;
+
+	static void fail(const char* what) {
+		throw std::system_error(errno, std::system_category(), what);
+	}
+
+	static size_t round_to_pages(size_t bytes) {
+		size_t page = sysconf(_SC_PAGESIZE);
+		if (page % sizeof(T))
+			throw std::invalid_argument(
+				"mirrored_ring element size must divide the "
+				"page size");
+		return std::max(page, (bytes + page - 1) / page * page);
+	}
+
+	void map(size_t bytes) {
+		int fd = memfd_create("cpputil-mirrored-ring", 0);
+		if (fd == -1)
+			fail("memfd_create");
+		if (ftruncate(fd, bytes) == -1) {
+			int err = errno;
+			close(fd);
+			errno = err;
+			fail("ftruncate");
+		}
+
+		// Reserve the whole window first so nothing else can land in
+		// the second half while we're mapping the first.
+		void* window = mmap(nullptr, 2 * bytes, PROT_NONE,
+				    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (window == MAP_FAILED) {
+			int err = errno;
+			close(fd);
+			errno = err;
+			fail("mmap");
+		}
+		char* p = static_cast<char*>(window);
+		for (char* half : {p, p + bytes}) {
+			if (mmap(half, bytes, PROT_READ | PROT_WRITE,
+				 MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+				int err = errno;
+				munmap(window, 2 * bytes);
+				close(fd);
+				errno = err;
+				fail("mmap");
+			}
+		}
+		// The mappings keep the memory alive.
+		close(fd);
+		base = reinterpret_cast<T*>(p);
+	}
+
+public:
+	using value_type = T;
+
+	// Holds at least capacity elements.
+	explicit mirrored_ring(size_t capacity) : head(0), count(0) {
+		size_t bytes = round_to_pages(capacity * sizeof(T));
+		map(bytes);
+		cap = bytes / sizeof(T);
+	}
+
+	mirrored_ring(mirrored_ring&& o) noexcept
+		: base(o.base), cap(o.cap), head(o.head), count(o.count) {
+		o.base = nullptr;
+		o.cap = o.head = o.count = 0;
+	}
+
+	~mirrored_ring() {
+		if (base)
+			munmap(base, 2 * cap * sizeof(T));
+	}
+
+	size_t capacity() const {
+		return cap;
+	}
+
+	size_t size() const {
+		return count;
+	}
+
+	bool empty() const {
+		return count == 0;
+	}
+
+	bool full() const {
+		return count == cap;
+	}
+
+	void clear() {
+		head = count = 0;
+	}
+
+	// Everything in the ring, oldest first.
+	array_ref<T> readable() const {
+		return array_ref<T>(base + head, count);
+	}
+
+	// Drops the n oldest elements.
+	void consume(size_t n) {
+		assert(n <= count);
+		head = (head + n) % cap;
+		count -= n;
+	}
+
+	// All free space, to be filled and then commit()ed.
+	writable_ref<T> writable() {
+		return writable_ref<T>(base + head + count, cap - count);
+	}
+
+	void commit(size_t n) {
+		assert(n <= cap - count);
+		count += n;
+	}
+
+	// Copies in as much of [data, data + n) as fits, and returns how much
+	// that was.
+	size_t write(const T* data, size_t n) {
+		n = std::min(n, cap - count);
+		std::memcpy(base + head + count, data, n * sizeof(T));
+		count += n;
+		return n;
+	}
+
+	// Copies out and consumes up to n elements, and returns how many.
+	size_t read(T* data, size_t n) {
+		n = std::min(n, count);
+		std::memcpy(data, base + head, n * sizeof(T));
+		consume(n);
+		return n;
+	}
+};
+
+}
+#endif
@@ -0,0 +1,270 @@
+//============================================================================
+//                                  libcpp-util
+//                   A simple odds-n-ends library for C++11
+//
+//         Licensed under modified BSD license. See LICENSE for details.
+//============================================================================
+
+#ifndef LIBCPP_UTIL_MULTICAST_RING_H
+#define LIBCPP_UTIL_MULTICAST_RING_H
+
+#include "libcpp-util/fifo/concurrent_queue.h"
+#include "libcpp-util/smp/spinlock.h"
+#include "libcpp-util/smp/wait_policy.h"
+#include "libcpp-util/util/raw_array.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <new>
+
+namespace cpputil {
+
+// Disruptor-style ring where every element is seen by every consumer, rather
+// than by exactly one as in concurrent_queue. Each of the Consumers has its
+// own cursor (the next position it will read) on its own cacheline, and all
+// of them read the same slot in place, so fanning out to more consumers costs
+// no copies. Producers are gated only by the slowest cursor: a slot is reused
+// once every consumer has released it.
+//
+// Consumers are numbered 0 to Consumers - 1, and each number must only be
+// used by one thread at a time. Producers claim positions through the
+// atomic_discipline for MultiProducer, so a single producer never CASes.
+// Every claimed position has to be published before the ring is destroyed.
+template <typename T, size_t N, unsigned Consumers, bool MultiProducer = true,
+	  class WaitPolicy = condvar_wait_policy,
+	  class Alloc = std::allocator<T>>
+class multicast_ring {
+	static_assert(Consumers > 0, "multicast_ring needs a consumer");
+
+private:
+	using discipline = atomic_discipline<MultiProducer, false>;
+
+	struct alignas(cacheline_size) cursor {
+		std::atomic_size_t pos;
+	};
+
+	// Producer-owned. gate is a lower bound on the slowest cursor, so
+	// producers only walk the cursors when the ring looks full.
+	alignas(cacheline_size) typename discipline::tail_index_type tail;
+	std::atomic_size_t gate;
+
+	cursor cursors[Consumers];
+
+	// Slow path state, only touched when somebody waits.
+	alignas(cacheline_size) std::atomic_bool open;
+	WaitPolicy not_full, not_empty;
+
+	multicast_ring(const multicast_ring&) = delete;
+	multicast_ring& operator=(const multicast_ring&) = delete;
+
+	Alloc alloc;
+	using alloc_traits = std::allocator_traits<Alloc>;
+	raw_array<T, N> fifo;
+	// published[i] holds pos + 1 for the last position published into
+	// slot i. It starts out as though the lap before position 0 had been
+	// published, which lets publish() recover a slot's position.
+	std::atomic_size_t published[N];
+
+	std::size_t slowest_cursor() {
+		std::size_t min = cursors[0].pos.load(std::memory_order_acquire);
+		for (unsigned i = 1; i < Consumers; ++i)
+			min = std::min(min, cursors[i].pos.load(
+						    std::memory_order_acquire));
+		return min;
+	}
+
+	// Producer side
+
+	// With several producers, pos may be stale: another producer can have
+	// claimed past it and the consumers caught up, moving the gate beyond
+	// it. That isn't a full ring, so it counts as room, and the claim that
+	// follows fails and reloads the tail.
+	static bool has_room_after(std::size_t pos, std::size_t gate_pos) {
+		return pos - gate_pos < N || gate_pos > pos;
+	}
+
+	bool has_empty_space(std::size_t pos) {
+		if (has_room_after(pos, gate.load(std::memory_order_acquire)))
+			return true;
+		std::size_t min = slowest_cursor();
+		// Release so that producers trusting the cached gate also see
+		// the consumers' reads of the slots it frees as finished.
+		gate.store(min, std::memory_order_release);
+		return has_room_after(pos, min);
+	}
+
+	void wait_for_empty_space() {
+		not_full.wait([&] {
+			return has_empty_space(discipline::load_index(tail));
+		});
+	}
+
+	bool claim_tail(std::size_t& pos) {
+		pos = discipline::load_index(tail);
+		do {
+			if (!has_empty_space(pos))
+				return false;
+		} while (!discipline::claim_index(tail, pos));
+		return true;
+	}
+
+	void construct_slot(T* slot) {
+		::new (static_cast<void*>(slot)) T;
+	}
+
+	template <class... Args>
+	void construct_slot(T* slot, Args&&... args) {
+		alloc_traits::construct(alloc, slot,
+					std::forward<Args>(args)...);
+	}
+
+	// Every consumer has moved past the element from the previous lap,
+	// so the slot can be recycled.
+	template <class... Args>
+	T* fill_slot(std::size_t pos, Args&&... args) {
+		T* slot = &fifo[pos % N];
+		if (pos >= N)
+			alloc_traits::destroy(alloc, slot);
+		construct_slot(slot, std::forward<Args>(args)...);
+		return slot;
+	}
+
+	void publish_tail(std::size_t pos) {
+		published[pos % N].store(pos + 1, std::memory_order_release);
+		// Every consumer wants every element.
+		not_empty.notify_all();
+	}
+
+	// Consumer side
+	bool has_used_space(std::size_t pos) {
+		return published[pos % N].load(std::memory_order_acquire) ==
+		       pos + 1;
+	}
+
+public:
+	using value_type = T;
+	using allocator_type = Alloc;
+
+	multicast_ring() : tail(0), gate(0), open(true) {
+		for (auto& c : cursors)
+			c.pos.store(0, std::memory_order_relaxed);
+		for (std::size_t i = 0; i < N; ++i)
+			published[i].store(i + 1 - N, std::memory_order_relaxed);
+	}
+	~multicast_ring() {
+		std::size_t end = discipline::load_index(tail);
+		for (std::size_t pos = end > N ? end - N : 0; pos != end; ++pos)
+			alloc_traits::destroy(alloc, &fifo[pos % N]);
+	}
+
+	bool is_closed() const {
+		return !open;
+	}
+
+	void close() {
+		open = false;
+		not_empty.notify_all(); // Make sure to wake any readers
+	}
+
+	constexpr size_t capacity() const {
+		return N;
+	}
+
+	constexpr unsigned consumers() const {
+		return Consumers;
+	}
+
+	// Producers
+	template <class... Args>
+	T* try_claim(Args&&... args) {
+		std::size_t pos;
+		if (!claim_tail(pos))
+			return nullptr;
+		return fill_slot(pos, std::forward<Args>(args)...);
+	}
+
+	template <class... Args>
+	T& claim(Args&&... args) {
+		std::size_t pos;
+		while (!claim_tail(pos))
+			wait_for_empty_space();
+		return *fill_slot(pos, std::forward<Args>(args)...);
+	}
+
+	void publish(T& slot) {
+		std::size_t index = &slot - &fifo[0];
+		publish_tail(published[index].load(std::memory_order_relaxed) +
+			     N - 1);
+	}
+
+	template <class... Args>
+	bool try_emplace(Args&&... args) {
+		std::size_t pos;
+		if (!claim_tail(pos))
+			return false;
+		fill_slot(pos, std::forward<Args>(args)...);
+		publish_tail(pos);
+		return true;
+	}
+
+	template <class... Args>
+	void emplace(Args&&... args) {
+		std::size_t pos;
+		while (!claim_tail(pos))
+			wait_for_empty_space();
+		fill_slot(pos, std::forward<Args>(args)...);
+		publish_tail(pos);
+	}
+
+	void push(const T& val) {
+		emplace(val);
+	}
+
+	void push(T&& val) {
+		emplace(std::move(val));
+	}
+
+	bool try_push(const T& val) {
+		return try_emplace(val);
+	}
+
+	bool try_push(T&& val) {
+		return try_emplace(std::move(val));
+	}
+
+	// Consumers. peek() returns the consumer's next element in place,
+	// which stays valid until the consumer calls release().
+	const T* try_peek(unsigned consumer) {
+		assert(consumer < Consumers && "No such consumer");
+		std::size_t pos =
+			cursors[consumer].pos.load(std::memory_order_relaxed);
+		return has_used_space(pos) ? &fifo[pos % N] : nullptr;
+	}
+
+	// Returns nullptr once the ring is closed and this consumer has seen
+	// everything published.
+	const T* peek(unsigned consumer) {
+		assert(consumer < Consumers && "No such consumer");
+		std::size_t pos =
+			cursors[consumer].pos.load(std::memory_order_relaxed);
+		not_empty.wait(
+			[&] { return has_used_space(pos) || is_closed(); });
+		return has_used_space(pos) ? &fifo[pos % N] : nullptr;
+	}
+
+	void release(unsigned consumer) {
+		assert(consumer < Consumers && "No such consumer");
+		std::size_t pos =
+			cursors[consumer].pos.load(std::memory_order_relaxed);
+		cursors[consumer].pos.store(pos + 1, std::memory_order_release);
+		// We can't tell whether we were the slowest, and any producer
+		// might be waiting on us.
+		not_full.notify_all();
+	}
+};
+
+}
+#endif
@@ -0,0 +1,216 @@
+//============================================================================
+//                                  libcpp-util
+//                   A simple odds-n-ends library for C++11
+//
+//         Licensed under modified BSD license. See LICENSE for details.
+//============================================================================
+
+#ifndef LIBCPP_UTIL_PRIORITY_QUEUE_H
+#define LIBCPP_UTIL_PRIORITY_QUEUE_H
+
+#include "libcpp-util/smp/spinlock.h"
+#include "libcpp-util/smp/wait_policy.h"
+#include "libcpp-util/util/raw_array.h"
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace cpputil {
+
+// Bounded multi-producer/multi-consumer queue with a handful of fixed
+// priority levels, 0 being the most urgent. pop() always takes the oldest
+// element of the most urgent non-empty level; within a level it's FIFO.
+//
+// Every level is a ring of N elements over a raw_array, behind its own
+// spinlock, so traffic on one level never contends with another. A bitmask
+// with a bit per non-empty level sits beside them; a level's bit only changes
+// under that level's lock, as it goes empty or stops being so. pop() finds
+// its level with a count-trailing-zeros on the mask and never scans. The mask
+// can be stale by the time the lock is taken, in which case it just looks
+// again.
+template <typename T, size_t N, unsigned Levels = 4,
+	  class WaitPolicy = condvar_wait_policy,
+	  class Alloc = std::allocator<T>>
+class concurrent_priority_queue {
+	static_assert(Levels > 0 && Levels <= 64,
+		      "Between 1 and 64 priority levels");
+	static_assert(N > 0, "Levels need at least one slot");
+
+private:
+	using alloc_traits = std::allocator_traits<Alloc>;
+
+	struct level {
+		cacheline_spinlock lock;
+		std::size_t head;
+		// Only changed under lock; atomic so waiters can peek.
+		std::atomic_size_t count;
+		raw_array<T, N> ring;
+		WaitPolicy not_full;
+
+		level() : head(0), count(0) {}
+	};
+
+	alignas(cacheline_size) std::atomic<std::uint64_t> nonempty;
+	std::atomic_bool open;
+	WaitPolicy not_empty;
+	Alloc alloc;
+	level levels[Levels];
+
+	concurrent_priority_queue(const concurrent_priority_queue&) = delete;
+	concurrent_priority_queue& operator=(
+		const concurrent_priority_queue&) = delete;
+
+	static unsigned lowest_bit(std::uint64_t mask) {
+#if __GNUC__
+		return __builtin_ctzll(mask);
+#else
+		unsigned bit = 0;
+		while (!(mask & 1)) {
+			mask >>= 1;
+			++bit;
+		}
+		return bit;
+#endif
+	}
+
+public:
+	using value_type = T;
+	using allocator_type = Alloc;
+
+	concurrent_priority_queue() : nonempty(0), open(true) {}
+
+	~concurrent_priority_queue() {
+		for (auto& l : levels) {
+			auto n = l.count.load(std::memory_order_relaxed);
+			for (std::size_t i = 0; i < n; ++i)
+				alloc_traits::destroy(
+					alloc, &l.ring[(l.head + i) % N]);
+		}
+	}
+
+	bool is_closed() const {
+		return !open;
+	}
+
+	void close() {
+		open = false;
+		not_empty.notify_all();
+	}
+
+	// Per level.
+	constexpr size_t capacity() const {
+		return N;
+	}
+
+	constexpr unsigned priorities() const {
+		return Levels;
+	}
+
+	template <class... Args>
+	bool try_emplace(unsigned priority, Args&&... args) {
+		assert(priority < Levels && "No such priority");
+		level& l = levels[priority];
+		{
+			std::lock_guard<cacheline_spinlock> g(l.lock);
+			auto n = l.count.load(std::memory_order_relaxed);
+			if (n == N)
+				return false;
+			alloc_traits::construct(alloc,
+						&l.ring[(l.head + n) % N],
+						std::forward<Args>(args)...);
+			l.count.store(n + 1, std::memory_order_relaxed);
+			if (!n)
+				nonempty.fetch_or(
+					std::uint64_t(1) << priority,
+					std::memory_order_release);
+		}
+		not_empty.notify_one();
+		return true;
+	}
+
+	template <class... Args>
+	void emplace(unsigned priority, Args&&... args) {
+		// Nothing is forwarded unless there's room, so retrying can't
+		// see moved-from arguments. Waiting doesn't push from inside
+		// the wait, since that would notify not_empty from under
+		// not_full, and pop() does the reverse.
+		assert(priority < Levels && "No such priority");
+		level& l = levels[priority];
+		auto has_room = [&] {
+			return l.count.load(std::memory_order_relaxed) < N;
+		};
+		while (!try_emplace(priority, std::forward<Args>(args)...))
+			l.not_full.wait(has_room);
+	}
+
+	void push(unsigned priority, const T& val) {
+		emplace(priority, val);
+	}
+
+	void push(unsigned priority, T&& val) {
+		emplace(priority, std::move(val));
+	}
+
+	bool try_push(unsigned priority, const T& val) {
+		return try_emplace(priority, val);
+	}
+
+	bool try_push(unsigned priority, T&& val) {
+		return try_emplace(priority, std::move(val));
+	}
+
+	// Also says which level val came from, if priority isn't null.
+	bool try_pop(T& val, unsigned* priority = nullptr) {
+		std::uint64_t mask;
+		while ((mask = nonempty.load(std::memory_order_acquire))) {
+			unsigned p = lowest_bit(mask);
+			level& l = levels[p];
+			{
+				std::lock_guard<cacheline_spinlock> g(l.lock);
+				std::size_t n =
+					l.count.load(std::memory_order_relaxed);
+				// Someone beat us to it.
+				if (!n)
+					continue;
+				T& elem = l.ring[l.head];
+				val = std::move(elem);
+				alloc_traits::destroy(alloc, &elem);
+				l.head = (l.head + 1) % N;
+				l.count.store(n - 1, std::memory_order_relaxed);
+				if (n == 1)
+					nonempty.fetch_and(
+						~(std::uint64_t(1) << p),
+						std::memory_order_relaxed);
+			}
+			l.not_full.notify_one();
+			if (priority)
+				*priority = p;
+			return true;
+		}
+		return false;
+	}
+
+	// Returns false once the queue is closed and drained.
+	bool pop(T& val, unsigned* priority = nullptr) {
+		auto ready = [&] {
+			return nonempty.load(std::memory_order_relaxed) ||
+			       is_closed();
+		};
+		while (!try_pop(val, priority)) {
+			// Anything pushed before close() is still ours to
+			// drain.
+			if (is_closed())
+				return try_pop(val, priority);
+			not_empty.wait(ready);
+		}
+		return true;
+	}
+};
+
+}
+#endif
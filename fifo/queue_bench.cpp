@@ -0,0 +1,170 @@
+// Throughput and end-to-end latency of concurrent_queue for every discipline,
+// across producer/consumer counts, element sizes and capacities.
+//
+// Usage: queue_bench [messages per producer] [--pin]
+//
+// --pin pins thread i to CPU i (mod the number of CPUs), producers first.
+#include "concurrent_queue.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace cpputil;
+using bench_clock = std::chrono::steady_clock;
+
+static unsigned messages = 200000;
+static bool pin = false;
+
+template <std::size_t Size>
+struct message {
+	std::uint64_t stamp;
+	char payload[Size - sizeof(std::uint64_t)];
+};
+
+template <>
+struct message<sizeof(std::uint64_t)> {
+	std::uint64_t stamp;
+};
+
+static std::uint64_t now_ns() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		       bench_clock::now().time_since_epoch()).count();
+}
+
+static void pin_thread(unsigned index) {
+#ifdef __linux__
+	if (!pin)
+		return;
+	unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(index % cpus, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+	(void)index;
+#endif
+}
+
+// Queues can be megabytes, so they go on the heap.
+template <class Queue>
+struct heap_queue : cacheline_aligned_new {
+	Queue q;
+};
+
+static std::uint64_t percentile(std::vector<std::uint64_t>& v, double p) {
+	if (v.empty())
+		return 0;
+	auto nth = v.begin() + static_cast<std::size_t>(p * (v.size() - 1));
+	std::nth_element(v.begin(), nth, v.end());
+	return *nth;
+}
+
+template <bool MP, bool MC, std::size_t Size, std::size_t Capacity>
+void run(const char* name, unsigned producers, unsigned consumers) {
+	using msg = message<Size>;
+	using queue = concurrent_queue<msg, Capacity, atomic_discipline<MP, MC>>;
+	std::unique_ptr<heap_queue<queue>> holder(new heap_queue<queue>);
+	queue& q = holder->q;
+
+	std::atomic_uint live(producers);
+	std::vector<std::vector<std::uint64_t>> latencies(consumers);
+	std::vector<std::thread> threads;
+
+	auto start = bench_clock::now();
+	for (unsigned p = 0; p < producers; ++p) {
+		threads.emplace_back([&, p] {
+			pin_thread(p);
+			msg m;
+			std::memset(&m, 0, sizeof(m));
+			for (unsigned i = 0; i < messages; ++i) {
+				m.stamp = now_ns();
+				q.push(m);
+			}
+			if (--live == 0)
+				q.close();
+		});
+	}
+	for (unsigned c = 0; c < consumers; ++c) {
+		threads.emplace_back([&, c] {
+			pin_thread(producers + c);
+			auto& lat = latencies[c];
+			lat.reserve(std::size_t(messages) * producers);
+			msg m;
+			while (q.pop(m))
+				lat.push_back(now_ns() - m.stamp);
+		});
+	}
+	for (auto& t : threads)
+		t.join();
+	std::chrono::duration<double> elapsed = bench_clock::now() - start;
+
+	std::vector<std::uint64_t> all;
+	for (auto& lat : latencies)
+		all.insert(all.end(), lat.begin(), lat.end());
+	double total = double(messages) * producers;
+	printf("%-5s %3u %3u %6zu %6zu %10.3f %10llu %10llu %10llu\n", name,
+	       producers, consumers, Size, Capacity,
+	       total / elapsed.count() / 1e6,
+	       (unsigned long long)percentile(all, 0.50),
+	       (unsigned long long)percentile(all, 0.99),
+	       (unsigned long long)percentile(all, 0.999));
+	fflush(stdout);
+}
+
+template <bool MP, bool MC, std::size_t Size, std::size_t Capacity>
+void sweep_threads(const char* name) {
+	static const unsigned counts[] = {1, 2, 4, 8};
+	for (unsigned p : counts) {
+		if (!MP && p > 1)
+			break;
+		for (unsigned c : counts) {
+			if (!MC && c > 1)
+				break;
+			run<MP, MC, Size, Capacity>(name, p, c);
+		}
+	}
+}
+
+template <bool MP, bool MC, std::size_t Size>
+void sweep_capacities(const char* name) {
+	sweep_threads<MP, MC, Size, 64>(name);
+	sweep_threads<MP, MC, Size, 1024>(name);
+}
+
+template <bool MP, bool MC>
+void sweep_sizes(const char* name) {
+	sweep_capacities<MP, MC, 8>(name);
+	sweep_capacities<MP, MC, 64>(name);
+	sweep_capacities<MP, MC, 512>(name);
+	sweep_capacities<MP, MC, 4096>(name);
+}
+
+int main(int argc, char* argv[]) {
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--pin"))
+			pin = true;
+		else
+			messages = std::stoi(argv[i]);
+	}
+
+	printf("%-5s %3s %3s %6s %6s %10s %10s %10s %10s\n", "queue", "P", "C",
+	       "bytes", "cap", "Mmsg/s", "p50 ns", "p99 ns", "p999 ns");
+	sweep_sizes<false, false>("spsc");
+	sweep_sizes<false, true>("spmc");
+	sweep_sizes<true, false>("mpsc");
+	sweep_sizes<true, true>("mpmc");
+	return 0;
+}
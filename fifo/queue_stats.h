@@ -0,0 +1,177 @@
+//============================================================================
+//                                  libcpp-util
+//                   A simple odds-n-ends library for C++11
+//
+//         Licensed under modified BSD license. See LICENSE for details.
+//============================================================================
+
+#ifndef LIBCPP_UTIL_QUEUE_STATS_H
+#define LIBCPP_UTIL_QUEUE_STATS_H
+
+#include "libcpp-util/smp/spinlock.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace cpputil {
+
+// Point-in-time copy of a queue's counters. Wait times only cover calls that
+// couldn't complete straight away. Every push samples the depth it left the
+// queue at: depth_histogram[i] counts those that left it holding between
+// 2^(i-1) and 2^i - 1 elements (the last bucket takes everything bigger), so
+// a push into an empty queue lands in bucket 1. The sample is taken from two
+// counters that aren't read together, and one that races with pops getting
+// ahead of it is clamped into bucket 0.
+struct queue_stats {
+	static constexpr unsigned depth_buckets = 32;
+
+	std::uint64_t pushes;
+	std::uint64_t pops;
+	std::uint64_t push_waits;
+	std::uint64_t pop_waits;
+	std::chrono::nanoseconds push_wait_time;
+	std::chrono::nanoseconds pop_wait_time;
+	// Times a producer (consumer) lost the race for an index to another.
+	std::uint64_t push_retries;
+	std::uint64_t pop_retries;
+	std::uint64_t depth_histogram[depth_buckets];
+};
+
+// Stats policies are mixed into concurrent_queue and told about everything
+// that happens to it. This one ignores it all and compiles away.
+struct no_queue_stats_policy {
+	void account_push(std::size_t) {}
+	void account_pop(std::size_t) {}
+	void account_push_retry() {}
+	void account_pop_retry() {}
+
+	template <class F>
+	void timed_push_wait(F&& wait) {
+		wait();
+	}
+
+	template <class F>
+	void timed_pop_wait(F&& wait) {
+		wait();
+	}
+
+	queue_stats snapshot() const {
+		return queue_stats();
+	}
+};
+
+// Keeps everything, with relaxed atomics. Producer and consumer counters sit
+// on separate cachelines so the two sides don't fight over them; the depth
+// sample reads the other side's count but never writes it.
+class queue_stats_policy {
+private:
+	using counter = std::atomic<std::uint_least64_t>;
+
+	struct alignas(cacheline_size) side {
+		counter ops;
+		counter waits;
+		counter wait_ns;
+		counter retries;
+	};
+
+	side producer, consumer;
+	counter depth_histogram[queue_stats::depth_buckets];
+
+	static unsigned depth_bucket(std::uint64_t depth) {
+		unsigned bucket = 0;
+		while (depth && bucket < queue_stats::depth_buckets - 1) {
+			depth >>= 1;
+			++bucket;
+		}
+		return bucket;
+	}
+
+	template <class F>
+	static void timed_wait(side& s, F&& wait) {
+		auto start = std::chrono::steady_clock::now();
+		wait();
+		auto elapsed = std::chrono::steady_clock::now() - start;
+		s.waits.fetch_add(1, std::memory_order_relaxed);
+		s.wait_ns.fetch_add(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(
+				elapsed).count(),
+			std::memory_order_relaxed);
+	}
+
+	static void reset(side& s) {
+		s.ops.store(0, std::memory_order_relaxed);
+		s.waits.store(0, std::memory_order_relaxed);
+		s.wait_ns.store(0, std::memory_order_relaxed);
+		s.retries.store(0, std::memory_order_relaxed);
+	}
+
+public:
+	queue_stats_policy() {
+		reset();
+	}
+
+	void account_push(std::size_t n) {
+		std::uint64_t pushed =
+			producer.ops.fetch_add(n, std::memory_order_relaxed) + n;
+		std::uint64_t popped =
+			consumer.ops.load(std::memory_order_relaxed);
+		// The two counts aren't read together, so clamp.
+		std::uint64_t depth = pushed > popped ? pushed - popped : 0;
+		depth_histogram[depth_bucket(depth)].fetch_add(
+			1, std::memory_order_relaxed);
+	}
+
+	void account_pop(std::size_t n) {
+		consumer.ops.fetch_add(n, std::memory_order_relaxed);
+	}
+
+	void account_push_retry() {
+		producer.retries.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void account_pop_retry() {
+		consumer.retries.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	template <class F>
+	void timed_push_wait(F&& wait) {
+		timed_wait(producer, wait);
+	}
+
+	template <class F>
+	void timed_pop_wait(F&& wait) {
+		timed_wait(consumer, wait);
+	}
+
+	queue_stats snapshot() const {
+		queue_stats s;
+		s.pushes = producer.ops.load(std::memory_order_relaxed);
+		s.pops = consumer.ops.load(std::memory_order_relaxed);
+		s.push_waits = producer.waits.load(std::memory_order_relaxed);
+		s.pop_waits = consumer.waits.load(std::memory_order_relaxed);
+		s.push_wait_time = std::chrono::nanoseconds(
+			producer.wait_ns.load(std::memory_order_relaxed));
+		s.pop_wait_time = std::chrono::nanoseconds(
+			consumer.wait_ns.load(std::memory_order_relaxed));
+		s.push_retries = producer.retries.load(std::memory_order_relaxed);
+		s.pop_retries = consumer.retries.load(std::memory_order_relaxed);
+		for (unsigned i = 0; i < queue_stats::depth_buckets; ++i)
+			s.depth_histogram[i] =
+				depth_histogram[i].load(std::memory_order_relaxed);
+		return s;
+	}
+
+	// Not atomic with respect to a running queue; counts racing with a
+	// reset may land on either side of it.
+	void reset() {
+		reset(producer);
+		reset(consumer);
+		for (auto& bucket : depth_histogram)
+			bucket.store(0, std::memory_order_relaxed);
+	}
+};
+
+}
+#endif
@@ -0,0 +1,805 @@
+#include "concurrent_queue.h"
+#include "event_queue.h"
+#include "flight_recorder.h"
+#include "mirrored_ring.h"
+#include "multicast_ring.h"
+#include "priority_queue.h"
+#include "ring_buffer.h"
+#include "segmented_queue.h"
+#include "sharded_queue.h"
+#include "shm_queue.h"
+#include "work_stealing_deque.h"
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <system_error>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+template <typename Queue>
+void producer_consumer(unsigned count) {
+	Queue q;
+	std::thread producer([&] {
+		for (unsigned i = 0; i < count; ++i)
+			q.push(i);
+		q.close();
+	});
+
+	unsigned expected = 0, val;
+	while (q.pop(val)) {
+		if (val != expected++) {
+			puts("Out of order");
+			abort();
+		}
+	}
+	producer.join();
+	if (expected != count) {
+		puts("Lost elements");
+		abort();
+	}
+}
+
+// Every producer pushes the same range; every value must come out exactly
+// once per producer, and each producer's values must come out in order.
+template <typename Queue>
+void many_to_many(unsigned producers, unsigned consumers, unsigned count) {
+	Queue q;
+	std::vector<std::atomic_uint> seen(count);
+	std::atomic_uint live(producers);
+
+	std::vector<std::thread> threads;
+	for (unsigned p = 0; p < producers; ++p) {
+		threads.emplace_back([&, p] {
+			for (unsigned i = 0; i < count; ++i)
+				q.push(p * count + i);
+			if (--live == 0)
+				q.close();
+		});
+	}
+	for (unsigned c = 0; c < consumers; ++c) {
+		threads.emplace_back([&] {
+			std::vector<unsigned> last(producers, 0);
+			unsigned val;
+			while (q.pop(val)) {
+				unsigned p = val / count, i = val % count;
+				if (i && i <= last[p]) {
+					puts("Out of order");
+					abort();
+				}
+				last[p] = i;
+				seen[i]++;
+			}
+		});
+	}
+	for (auto& t : threads)
+		t.join();
+
+	for (auto& s : seen) {
+		if (s != producers) {
+			puts("Lost or duplicated elements");
+			abort();
+		}
+	}
+}
+
+template <typename Queue>
+void bulk(unsigned count) {
+	Queue q;
+	std::thread producer([&] {
+		std::vector<unsigned> batch;
+		for (unsigned i = 0; i < count; ++i) {
+			batch.push_back(i);
+			if (batch.size() == 100 || i == count - 1) {
+				q.push_bulk(batch.begin(), batch.end());
+				batch.clear();
+			}
+		}
+		q.close();
+	});
+
+	unsigned expected = 0, n;
+	std::vector<unsigned> out(37);
+	while ((n = q.pop_bulk(out.begin(), out.size()))) {
+		for (unsigned i = 0; i < n; ++i) {
+			if (out[i] != expected++) {
+				puts("Out of order");
+				abort();
+			}
+		}
+	}
+	producer.join();
+	if (expected != count) {
+		puts("Lost elements");
+		abort();
+	}
+}
+
+struct packet {
+	unsigned seq;
+	char payload[4096];
+};
+
+template <typename Queue>
+void zero_copy(unsigned count) {
+	Queue q;
+	std::thread producer([&] {
+		for (unsigned i = 0; i < count; ++i) {
+			packet& p = q.claim();
+			p.seq = i;
+			p.payload[sizeof(p.payload) - 1] = char(i);
+			q.publish(p);
+		}
+		q.close();
+	});
+
+	unsigned expected = 0;
+	while (const packet* p = q.peek()) {
+		if (p->seq != expected ||
+		    p->payload[sizeof(p->payload) - 1] != char(expected)) {
+			puts("Out of order");
+			abort();
+		}
+		++expected;
+		q.release(*p);
+	}
+	producer.join();
+	if (expected != count) {
+		puts("Lost elements");
+		abort();
+	}
+}
+
+// Every consumer has to see every producer's values, in order.
+void multicast(unsigned producers, unsigned count) {
+	static const unsigned consumers = 3;
+	cpputil::multicast_ring<unsigned, 64, consumers> ring;
+	std::atomic_uint live(producers);
+
+	std::vector<std::thread> threads;
+	for (unsigned p = 0; p < producers; ++p) {
+		threads.emplace_back([&, p] {
+			for (unsigned i = 0; i < count; ++i)
+				ring.push(p * count + i);
+			if (--live == 0)
+				ring.close();
+		});
+	}
+	for (unsigned c = 0; c < consumers; ++c) {
+		threads.emplace_back([&, c] {
+			std::vector<unsigned> next(producers, 0);
+			while (const unsigned* val = ring.peek(c)) {
+				unsigned p = *val / count, i = *val % count;
+				if (i != next[p]++) {
+					puts("Out of order");
+					abort();
+				}
+				ring.release(c);
+			}
+			for (auto n : next) {
+				if (n != count) {
+					puts("Lost elements");
+					abort();
+				}
+			}
+		});
+	}
+	for (auto& t : threads)
+		t.join();
+}
+
+// The general ring lets one thread hold several claimed or peeked slots and
+// hand them back in any order.
+template <typename Queue>
+void outstanding_slots(unsigned rounds) {
+	Queue q;
+	for (unsigned r = 0; r < rounds; ++r) {
+		packet& a = q.claim();
+		packet& b = q.claim();
+		a.seq = 2 * r;
+		b.seq = 2 * r + 1;
+		q.publish(b);
+		if (q.try_peek()) {
+			puts("Peeked past an unpublished slot");
+			abort();
+		}
+		q.publish(a);
+		const packet* x = q.try_peek();
+		const packet* y = q.try_peek();
+		if (!x || !y || x->seq != 2 * r || y->seq != 2 * r + 1) {
+			puts("Out of order");
+			abort();
+		}
+		q.release(*y);
+		q.release(*x);
+	}
+	if (q.try_peek()) {
+		puts("Extra element");
+		abort();
+	}
+}
+
+template <typename Queue>
+void stats(unsigned count) {
+	Queue q;
+	std::thread producer([&] {
+		for (unsigned i = 0; i < count; ++i)
+			q.push(i);
+		q.close();
+	});
+	unsigned val;
+	while (q.pop(val))
+		;
+	producer.join();
+
+	cpputil::queue_stats s = q.stats();
+	std::uint64_t samples = 0;
+	for (auto bucket : s.depth_histogram)
+		samples += bucket;
+	if (s.pushes != count || s.pops != count || samples != count) {
+		puts("Bad stats");
+		abort();
+	}
+
+	// Blocking calls that never have to block don't count as waits.
+	Queue idle;
+	unsigned batch[4] = {1, 2, 3, 4};
+	for (unsigned i = 0; i < 10; ++i)
+		idle.push(i);
+	for (unsigned i = 0; i < 10; ++i)
+		idle.pop(val);
+	idle.push_bulk(batch, batch + 4);
+	idle.pop_bulk(batch, 4);
+	idle.publish(idle.claim(0u));
+	idle.release(*idle.peek());
+	s = idle.stats();
+	if (s.push_waits != 0 || s.pop_waits != 0) {
+		puts("Uncontended operations counted as waits");
+		abort();
+	}
+}
+
+// An allocator passed as the fourth parameter, where it has always been,
+// is the one the queue constructs elements with.
+template <typename T>
+struct counting_allocator : std::allocator<T> {
+	static unsigned constructed;
+
+	template <class U>
+	struct rebind {
+		using other = counting_allocator<U>;
+	};
+
+	counting_allocator() = default;
+	template <class U>
+	counting_allocator(const counting_allocator<U>&) {}
+
+	template <class U, class... Args>
+	void construct(U* p, Args&&... args) {
+		++constructed;
+		::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+	}
+};
+
+template <typename T>
+unsigned counting_allocator<T>::constructed = 0;
+
+template <class AtomicPolicy>
+void allocator(unsigned count) {
+	using alloc = counting_allocator<unsigned>;
+	cpputil::concurrent_queue<unsigned, 64, AtomicPolicy, alloc> q;
+	static_assert(std::is_same<typename decltype(q)::allocator_type,
+				   alloc>::value,
+		      "Allocator in the wrong place");
+	alloc::constructed = 0;
+	unsigned val;
+	for (unsigned i = 0; i < count; ++i) {
+		q.push(i);
+		if (!q.try_pop(val) || val != i) {
+			puts("Lost elements");
+			abort();
+		}
+	}
+	if (alloc::constructed != count) {
+		puts("Allocator not used");
+		abort();
+	}
+}
+
+// The owner pushes in small bursts and takes some back while thieves steal,
+// so the deque keeps running down to its last element, which the owner and
+// a thief then race for. Every item must be taken exactly once. It starts
+// tiny so it has to grow under the thieves too.
+void work_stealing(unsigned thieves, unsigned count) {
+	cpputil::work_stealing_deque<unsigned> deque(2);
+	std::vector<std::atomic<unsigned char>> taken(count);
+	for (auto& t : taken)
+		t.store(0, std::memory_order_relaxed);
+	std::atomic<unsigned> total(0);
+	std::atomic_bool done(false);
+
+	auto take = [&](unsigned val) {
+		if (val >= count || taken[val].fetch_add(1)) {
+			puts("Taken twice");
+			abort();
+		}
+		++total;
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned t = 0; t < thieves; ++t) {
+		threads.emplace_back([&] {
+			unsigned val;
+			while (!done.load(std::memory_order_relaxed) ||
+			       !deque.empty()) {
+				if (deque.steal(val))
+					take(val);
+			}
+		});
+	}
+
+	unsigned val;
+	for (unsigned i = 0; i < count; ) {
+		unsigned burst = 1 + i % 7;
+		for (unsigned j = 0; j < burst && i < count; ++j)
+			deque.push(i++);
+		for (unsigned j = 0; j < burst / 2 + 1; ++j) {
+			if (deque.take(val))
+				take(val);
+		}
+	}
+	while (deque.take(val))
+		take(val);
+	done = true;
+	for (auto& t : threads)
+		t.join();
+	if (total != count) {
+		puts("Lost elements");
+		abort();
+	}
+}
+
+struct stamped {
+	unsigned seq;
+	unsigned check;
+};
+
+// A child process attaches to the parent's memfd queue and pushes through it
+// while the parent pops. The ring is much smaller than the message count, so
+// both sides keep blocking on the process-shared futexes; with no spinning
+// they go straight to sleep whenever they have to wait.
+template <class AtomicPolicy, class WaitPolicy>
+void cross_process(unsigned count) {
+	using queue = cpputil::shm_queue<stamped, 16, AtomicPolicy, WaitPolicy>;
+	queue parent;
+	fflush(stdout);
+	pid_t child = fork();
+	if (child == -1) {
+		puts("fork failed");
+		abort();
+	}
+	if (!child) {
+		queue q(dup(parent.file_descriptor()),
+			cpputil::shm_open_mode::attach);
+		for (unsigned i = 0; i < count; ++i)
+			q->push(stamped{i, ~i});
+		q->close();
+		_exit(0);
+	}
+
+	stamped m;
+	unsigned expected = 0;
+	while (parent->pop(m)) {
+		if (m.seq != expected++ || m.check != ~m.seq) {
+			puts("Out of order");
+			abort();
+		}
+	}
+	int status;
+	if (waitpid(child, &status, 0) != child || !WIFEXITED(status) ||
+	    WEXITSTATUS(status)) {
+		puts("Child failed");
+		abort();
+	}
+	if (expected != count) {
+		puts("Lost elements");
+		abort();
+	}
+
+	// Nobody ever finishes creating this one.
+	int fd = memfd_create("cpputil-test", 0);
+	if (fd == -1 || ftruncate(fd, 1 << 20) == -1) {
+		puts("memfd failed");
+		abort();
+	}
+	try {
+		queue q(fd, cpputil::shm_open_mode::attach,
+			std::chrono::milliseconds(10));
+		puts("Attached to an uninitialized queue");
+		abort();
+	} catch (const std::system_error& e) {
+		if (e.code().value() != ETIMEDOUT) {
+			puts("Wrong attach error");
+			abort();
+		}
+	}
+}
+
+// Urgent elements overtake everything queued behind them, and each level is
+// FIFO, whether or not anyone else is pushing and popping at the same time.
+void priority(unsigned producers, unsigned count) {
+	static const unsigned levels = 4;
+	cpputil::concurrent_priority_queue<unsigned, 64, levels> q;
+
+	for (unsigned i = 0; i < 64; ++i)
+		q.push(levels - 1 - i % levels, i);
+	unsigned val, prio, last_prio = 0, next[levels] = {};
+	while (q.try_pop(val, &prio)) {
+		if (prio < last_prio || prio != levels - 1 - val % levels ||
+		    val / levels != next[prio]++) {
+			puts("Out of order");
+			abort();
+		}
+		last_prio = prio;
+	}
+
+#ifndef NDEBUG
+	// A level that doesn't exist is caught rather than scribbling past
+	// the end of the levels.
+	pid_t child = fork();
+	if (child == 0) {
+		if (!freopen("/dev/null", "w", stderr))
+			_exit(1);
+		q.try_push(levels, 0);
+		_exit(0);
+	}
+	int status;
+	if (child == -1 || waitpid(child, &status, 0) != child ||
+	    !WIFSIGNALED(status) || WTERMSIG(status) != SIGABRT) {
+		puts("Bad priority accepted");
+		abort();
+	}
+#endif
+
+	std::atomic_uint live(producers);
+	std::vector<std::thread> threads;
+	for (unsigned p = 0; p < producers; ++p) {
+		threads.emplace_back([&, p] {
+			for (unsigned i = 0; i < count; ++i)
+				q.push(p % levels, p * count + i);
+			if (--live == 0)
+				q.close();
+		});
+	}
+	std::vector<unsigned> seen(producers, 0);
+	while (q.pop(val)) {
+		unsigned p = val / count, i = val % count;
+		if (i != seen[p]++) {
+			puts("Out of order");
+			abort();
+		}
+	}
+	for (auto& t : threads)
+		t.join();
+	for (auto n : seen) {
+		if (n != count) {
+			puts("Lost elements");
+			abort();
+		}
+	}
+}
+
+// Bytes go out of one ring and into another through a pipe, with
+// writev/readv straight from and to their spans. Popping a few at a time
+// keeps moving where the spans wrap.
+void ring_io(unsigned rounds) {
+	cpputil::ring_buffer<char, 64> in, out;
+	int fds[2];
+	if (pipe(fds)) {
+		puts("No pipe");
+		abort();
+	}
+
+	unsigned next_in = 0, next_out = 0;
+	char c;
+	auto check = [&](char got) {
+		if (got != char(next_out++ % 251)) {
+			puts("Out of order");
+			abort();
+		}
+	};
+	iovec iov[2];
+	for (unsigned r = 0; r <= rounds; ++r) {
+		if (r < rounds) {
+			while (in.push(char(next_in % 251)))
+				++next_in;
+			for (unsigned i = 0; i < r % 13 && in.pop_value(c); ++i)
+				if (write(fds[1], &c, 1) != 1)
+					abort();
+			while (in.push(char(next_in % 251)))
+				++next_in;
+			ssize_t n = writev(fds[1], iov,
+					   cpputil::to_iovec(in.readable_spans(),
+							     iov));
+			if (n != ssize_t(in.size())) {
+				puts("Short write");
+				abort();
+			}
+			in.consume(n);
+		} else {
+			close(fds[1]);
+		}
+
+		while (1) {
+			ssize_t n = readv(fds[0], iov,
+					  cpputil::to_iovec(out.writable_spans(),
+							    iov));
+			if (n < 0) {
+				puts("Read failed");
+				abort();
+			}
+			out.commit(n);
+			for (unsigned i = out.size() / 2; i && out.pop_value(c);
+			     --i)
+				check(c);
+			// Only drain the pipe completely at the end.
+			if (r < rounds || !n)
+				break;
+		}
+	}
+	while (out.pop_value(c))
+		check(c);
+	close(fds[0]);
+	if (next_out != next_in) {
+		puts("Lost elements");
+		abort();
+	}
+}
+
+// Messages of every length up to the capacity, read back in place wherever
+// they fall in the ring.
+void mirrored(unsigned rounds) {
+	cpputil::mirrored_ring<char> ring(1);
+	std::vector<char> msg(ring.capacity());
+	unsigned next = 0;
+	for (unsigned r = 0; r < rounds; ++r) {
+		std::size_t len = 1 + (r * 7919) % ring.capacity();
+		for (auto& c : msg)
+			c = char(next++);
+		ring.consume(ring.size());
+		// Leave the head somewhere awkward.
+		ring.write(msg.data(), r % 97);
+		ring.consume(r % 97);
+		if (ring.write(msg.data(), len) != len) {
+			puts("Short write");
+			abort();
+		}
+		auto view = ring.readable();
+		if (view.size() != len ||
+		    std::memcmp(view.data(), msg.data(), len)) {
+			puts("Not contiguous");
+			abort();
+		}
+	}
+}
+
+struct trace_event {
+	std::uint64_t a, b, c;
+};
+
+// Snapshots taken while the writer runs must only hold whole entries, and
+// they must be the latest ones, in order.
+void flight_recorder(unsigned count) {
+	static const unsigned size = 64;
+	cpputil::flight_recorder<trace_event, size> rec;
+	std::atomic_bool done(false);
+	std::thread writer([&] {
+		for (std::uint64_t i = 0; i < count; ++i)
+			rec.push(trace_event{i, i * 3, ~i});
+		done = true;
+	});
+
+	trace_event snap[size];
+	bool last = false;
+	while (!last) {
+		last = done;
+		std::size_t n = rec.snapshot(snap);
+		for (std::size_t i = 0; i < n; ++i) {
+			const trace_event& e = snap[i];
+			if (e.b != e.a * 3 || e.c != ~e.a) {
+				puts("Torn entry");
+				abort();
+			}
+			if (i && e.a <= snap[i - 1].a) {
+				puts("Out of order");
+				abort();
+			}
+		}
+		if (last && (n != size || snap[n - 1].a != count - 1)) {
+			puts("Lost entries");
+			abort();
+		}
+	}
+	writer.join();
+}
+
+// More shards than this machine might have cores, so threads share them.
+struct four_shards : cpputil::sharded_queue<unsigned, 16> {
+	four_shards() : sharded_queue(4) {}
+};
+
+// The consumer only ever drains from a poll() loop. With a big batch, one
+// drain() usually has to go back to the queue for more while producers keep
+// pushing.
+template <std::size_t Batch>
+void event_loop(unsigned producers, unsigned count) {
+	cpputil::event_queue<unsigned, 64> q;
+	std::atomic_uint live(producers);
+
+	std::vector<std::thread> threads;
+	for (unsigned p = 0; p < producers; ++p) {
+		threads.emplace_back([&, p] {
+			for (unsigned i = 0; i < count; ++i)
+				q.push(p * count + i);
+			if (--live == 0)
+				q.close();
+		});
+	}
+
+	std::vector<unsigned> next(producers, 0);
+	std::vector<unsigned> batch(Batch);
+	while (1) {
+		pollfd pfd = {q.file_descriptor(), POLLIN, 0};
+		poll(&pfd, 1, -1);
+		bool closed = q.is_closed();
+		std::size_t n;
+		do {
+			n = q.drain(batch.data(), Batch);
+			for (std::size_t j = 0; j < n; ++j) {
+				unsigned p = batch[j] / count;
+				unsigned i = batch[j] % count;
+				if (i != next[p]++) {
+					puts("Out of order");
+					abort();
+				}
+			}
+		} while (n == Batch);
+		if (closed)
+			break;
+	}
+	for (auto& t : threads)
+		t.join();
+	for (auto n : next) {
+		if (n != count) {
+			puts("Lost elements");
+			abort();
+		}
+	}
+}
+
+// Output iterator that pushes another element into the queue for every one
+// written through it, until total have gone in. A drain() into it always has
+// to go back to the queue for what it pushed, and must keep appending rather
+// than start over at the front.
+struct refilling_iterator {
+	cpputil::event_queue<unsigned, 64>* q;
+	std::vector<unsigned>* out;
+	std::size_t pos;
+	unsigned* pushed;
+	unsigned total;
+
+	refilling_iterator& operator*() {
+		return *this;
+	}
+	refilling_iterator& operator++() {
+		++pos;
+		return *this;
+	}
+	refilling_iterator operator++(int) {
+		refilling_iterator old = *this;
+		++pos;
+		return old;
+	}
+	refilling_iterator& operator=(unsigned val) {
+		(*out)[pos] = val;
+		if (*pushed < total)
+			q->push((*pushed)++);
+		return *this;
+	}
+};
+
+void event_drain_refill(unsigned total) {
+	cpputil::event_queue<unsigned, 64> q;
+	std::vector<unsigned> out(2 * total, ~0u);
+	unsigned pushed = 0;
+	for (; pushed < 4; ++pushed)
+		q.push(pushed);
+	std::size_t n = q.drain(
+		refilling_iterator{&q, &out, 0, &pushed, total}, out.size());
+	if (n != total) {
+		puts("Lost elements");
+		abort();
+	}
+	for (unsigned i = 0; i < total; ++i) {
+		if (out[i] != i) {
+			puts("Out of order");
+			abort();
+		}
+	}
+}
+
+int main() {
+	puts("SPSC");
+	producer_consumer<cpputil::spsc_queue<unsigned, 64>>(1000000);
+	puts("MPSC");
+	many_to_many<cpputil::mpsc_queue<unsigned, 64>>(4, 1, 100000);
+	puts("SPMC");
+	many_to_many<cpputil::spmc_queue<unsigned, 64>>(1, 4, 100000);
+	puts("MPMC");
+	many_to_many<cpputil::mpmc_queue<unsigned, 64>>(4, 4, 100000);
+	puts("MPMC yielding");
+	many_to_many<cpputil::mpmc_queue<unsigned, 64,
+					 cpputil::yield_wait_policy<>>>(4, 4,
+									100000);
+	puts("MPMC futex");
+	many_to_many<cpputil::mpmc_queue<unsigned, 64,
+					 cpputil::futex_wait_policy<>>>(4, 4,
+									100000);
+	puts("SPSC bulk");
+	bulk<cpputil::spsc_queue<unsigned, 64>>(1000000);
+	puts("MPMC bulk");
+	bulk<cpputil::mpmc_queue<unsigned, 64>>(1000000);
+	puts("SPSC zero-copy");
+	zero_copy<cpputil::spsc_queue<packet, 16>>(100000);
+	puts("MPMC zero-copy");
+	zero_copy<cpputil::mpmc_queue<packet, 16>>(100000);
+	outstanding_slots<cpputil::mpmc_queue<packet, 4>>(100);
+	outstanding_slots<cpputil::spmc_queue<packet, 4>>(100);
+	puts("Stats");
+	stats<cpputil::spsc_queue<unsigned, 64, cpputil::condvar_wait_policy,
+				  cpputil::queue_stats_policy>>(100000);
+	stats<cpputil::mpmc_queue<unsigned, 64, cpputil::condvar_wait_policy,
+				  cpputil::queue_stats_policy>>(100000);
+	puts("Allocator");
+	allocator<cpputil::spsc_discipline>(1000);
+	allocator<cpputil::mpmc_discipline>(1000);
+	puts("Work-stealing deque");
+	work_stealing(3, 1000000);
+	puts("Shared memory");
+	cross_process<cpputil::spsc_discipline,
+		      cpputil::shared_futex_wait_policy<>>(100000);
+	cross_process<cpputil::spsc_discipline,
+		      cpputil::shared_futex_wait_policy<0>>(100000);
+	cross_process<cpputil::mpsc_discipline,
+		      cpputil::shared_futex_wait_policy<0>>(100000);
+	puts("Segmented");
+	many_to_many<cpputil::segmented_queue<unsigned, 16>>(4, 4, 100000);
+	puts("Sharded");
+	many_to_many<four_shards>(8, 4, 100000);
+	puts("Priority");
+	priority(8, 100000);
+	puts("Ring buffer");
+	ring_io(500);
+	puts("Mirrored ring");
+	mirrored(10000);
+	puts("Flight recorder");
+	flight_recorder(1000000);
+	puts("Multicast");
+	multicast(1, 100000);
+	multicast(4, 100000);
+	puts("Event loop");
+	event_loop<16>(1, 100000);
+	event_loop<16>(4, 100000);
+	event_loop<1024>(4, 100000);
+	event_drain_refill(1000);
+	return 0;
+}
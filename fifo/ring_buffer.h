@@ -8,68 +8,231 @@
 #ifndef LIBCPP_UTIL_RING_BUFFER_H
 #define LIBCPP_UTIL_RING_BUFFER_H
 
-#include "libcpp/util/raw_array.h"
-#include <memory>
+#include "libcpp-util/cxx14/array_ref.h"
+#include "libcpp-util/util/raw_array.h"
+
+#include <algorithm>
+#include <cassert>
 #include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#ifdef __unix__
+#include <sys/uio.h>
+#endif
+
+namespace cpputil {
+
+// Like array_ref, but the elements can be written through it. Only handed out
+// for free space in a ring_buffer, which array_ref can't describe.
+template <typename T>
+class writable_ref {
+private:
+	T* start;
+	size_t len;
 
+public:
+	using value_type = T;
+	using iterator = T*;
+
+	writable_ref() : start(nullptr), len(0) {}
+	writable_ref(T* data, size_t length) : start(data), len(length) {}
+
+	T* begin() const {
+		return start;
+	}
+	T* end() const {
+		return start + len;
+	}
+	T* data() const {
+		return start;
+	}
+	bool empty() const {
+		return len == 0;
+	}
+	size_t size() const {
+		return len;
+	}
+	T& operator[](size_t idx) const {
+		return start[idx];
+	}
+};
+
+// A region of a ring_buffer, which is contiguous unless it wraps around the
+// end of the storage, in which case second picks up at the start.
+template <class Ref>
+struct span_pair {
+	Ref first;
+	Ref second;
+
+	size_t size() const {
+		return first.size() + second.size();
+	}
+};
+
+// Unsynchronized circular FIFO of up to N elements, stored inline.
+//
+// Besides pushing and popping one element at a time, the buffer exposes its
+// contents and its free space directly, each as at most two contiguous runs,
+// so I/O can go straight in and out of it:
+//
+//	auto free = ring.writable_spans();
+//	iovec iov[2];
+//	ssize_t n = readv(fd, iov, to_iovec(free, iov));
+//	if (n > 0)
+//		ring.commit(n);
+//
+// Writing into free space skips construction, so writable_spans() and commit()
+// are only there for trivially copyable elements.
 template <typename T, size_t N, class Alloc = std::allocator<T>>
 class ring_buffer {
+	static_assert(N > 0, "ring_buffer needs at least one slot");
+
 private:
-	static std::size_t increment_index(std::size_t& index, unsigned N) {
-		std::size_t tmp = index;
-		index = (index + 1) % N;
-		return tmp;
-	}
+	using alloc_traits = std::allocator_traits<Alloc>;
 
-	size_t head, tail;
+	size_t head, count;
 
-	circ_fifo(const circ_fifo&) = delete;
-	circ_fifo& operator=(const circ_fifo&) = delete;
+	ring_buffer(const ring_buffer&) = delete;
+	ring_buffer& operator=(const ring_buffer&) = delete;
 
 	Alloc alloc;
 	raw_array<T, N> fifo;
 
+	size_t tail() const {
+		return (head + count) % N;
+	}
+
 public:
-	circ_fifo() : full(0), empty(N), head(0), tail(0) {}
+	using value_type = T;
+	using allocator_type = Alloc;
+
+	ring_buffer() : head(0), count(0) {}
 	// TODO: Other standard library type constructors
-	~circ_fifo() {
-		while (head != tail) {
-			alloc.destroy(&fifo[head]);
-			head = (head + 1) % N;
-		}
+	~ring_buffer() {
+		clear();
 	}
 
 	constexpr size_t capacity() const {
 		return N;
 	}
 
+	size_t size() const {
+		return count;
+	}
+
 	bool empty() const {
-		return head == tail;
+		return count == 0;
+	}
+
+	bool full() const {
+		return count == N;
 	}
 
+	void clear() {
+		consume(count);
+	}
+
+	// Returns false if the buffer is full.
 	template <class... Args>
-	void emplace(Args&&... args) {
-		auto tmp_tail = increment_index(tail, N);
-		alloc.construct(&fifo[tmp_tail], std::forward<Args>(args)...);
+	bool emplace(Args&&... args) {
+		if (full())
+			return false;
+		alloc_traits::construct(alloc, &fifo[tail()],
+					std::forward<Args>(args)...);
+		++count;
+		return true;
 	}
-	void push(const T& val) {
-		auto tmp_tail = increment_index(tail, N);
-		alloc.construct(&fifo[tmp_tail], val);
+
+	bool push(const T& val) {
+		return emplace(val);
+	}
+
+	bool push(T&& val) {
+		return emplace(std::move(val));
 	}
 
-	void push(T&& val) {
-		auto tmp_tail = increment_index(tail, N);
-		alloc.construct(&fifo[tmp_tail], std::move(val));
+	T& front() {
+		assert(!empty());
+		return fifo[head];
+	}
+
+	const T& front() const {
+		assert(!empty());
+		return fifo[head];
 	}
 
 	bool pop_value(T& val) {
-		if (head == tail)
+		if (empty())
 			return false;
-		auto tmp_head = increment_index(head, N);
-		val = std::move(fifo[tmp_head]);
-		alloc.destroy(&fifo[tmp_head]);
+		val = std::move(fifo[head]);
+		consume(1);
 		return true;
 	}
+
+	// Everything in the buffer, oldest first.
+	span_pair<array_ref<T>> readable_spans() const {
+		size_t first = std::min(count, N - head);
+		return {array_ref<T>(&fifo[head], first),
+			array_ref<T>(&fifo[0], count - first)};
+	}
+
+	// Drops the n oldest elements, say after writev() has sent them.
+	void consume(size_t n) {
+		assert(n <= count);
+		if (!std::is_trivially_destructible<T>::value) {
+			for (size_t i = 0; i < n; ++i)
+				alloc_traits::destroy(alloc,
+						      &fifo[(head + i) % N]);
+		}
+		head = (head + n) % N;
+		count -= n;
+		// Start over at the bottom so the next run of free space is
+		// as long as it can be.
+		if (!count)
+			head = 0;
+	}
+
+	// All free space, in the order it will be filled.
+	span_pair<writable_ref<T>> writable_spans() {
+		static_assert(std::is_trivially_copyable<T>::value,
+			      "Only trivially copyable elements can be written "
+			      "in place");
+		size_t t = tail(), free = N - count;
+		size_t first = std::min(free, N - t);
+		return {writable_ref<T>(&fifo[t], first),
+			writable_ref<T>(&fifo[0], free - first)};
+	}
+
+	// Makes the first n elements of writable_spans() part of the buffer.
+	void commit(size_t n) {
+		static_assert(std::is_trivially_copyable<T>::value,
+			      "Only trivially copyable elements can be written "
+			      "in place");
+		assert(n <= N - count);
+		count += n;
+	}
 };
 
+#ifdef __unix__
+// Fills iov from spans for readv()/writev() and friends, and returns how many
+// entries it used. Lengths are in bytes.
+template <class Ref>
+int to_iovec(const span_pair<Ref>& spans, iovec (&iov)[2]) {
+	const Ref* refs[] = {&spans.first, &spans.second};
+	int n = 0;
+	for (const Ref* r : refs) {
+		if (!r->size())
+			continue;
+		iov[n].iov_base = const_cast<void*>(
+			static_cast<const void*>(r->data()));
+		iov[n].iov_len = r->size() * sizeof(*r->data());
+		++n;
+	}
+	return n;
+}
+#endif
+
+}
 #endif
@@ -0,0 +1,267 @@
+//============================================================================
+//                                  libcpp-util
+//                   A simple odds-n-ends library for C++11
+//
+//         Licensed under modified BSD license. See LICENSE for details.
+//============================================================================
+
+#ifndef LIBCPP_UTIL_SEGMENTED_QUEUE_H
+#define LIBCPP_UTIL_SEGMENTED_QUEUE_H
+
+#include "libcpp-util/smp/spinlock.h"
+#include "libcpp-util/smp/wait_policy.h"
+#include "libcpp-util/util/raw_array.h"
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+
+namespace cpputil {
+
+// Unbounded multi-producer/multi-consumer FIFO made of a linked list of
+// fixed-size segments. Producers only ever take the tail lock, and consumers
+// the head lock, and each holds it just long enough to claim a slot (or to
+// step to the next segment); elements are constructed and moved out with no
+// lock held. A per-slot ready flag is what hands an element from its producer
+// to its consumer.
+//
+// Once every element of a segment has been moved out and the head has moved
+// past it, the segment goes back to a pool that producers take from before
+// going to the heap. A queue that has seen its biggest burst never allocates
+// again; reserve() can prime the pool up front, and trim() hands the pool back.
+template <typename T, size_t SegmentSize = 256,
+	  class WaitPolicy = condvar_wait_policy,
+	  class Alloc = std::allocator<T>>
+class segmented_queue {
+	static_assert(SegmentSize > 0, "Segments need at least one slot");
+
+private:
+	struct segment {
+		raw_array<T, SegmentSize> data;
+		std::atomic_bool ready[SegmentSize];
+		// Elements moved out, plus one when the head moves past.
+		std::atomic_size_t retired;
+		std::atomic<segment*> next;
+
+		segment() {
+			reset();
+		}
+
+		void reset() {
+			for (auto& r : ready)
+				r.store(false, std::memory_order_relaxed);
+			retired.store(0, std::memory_order_relaxed);
+			next.store(nullptr, std::memory_order_relaxed);
+		}
+	};
+
+	// Producer-owned.
+	cacheline_spinlock tail_lock;
+	segment* tail_seg;
+	std::size_t tail_index;
+
+	// Consumer-owned.
+	cacheline_spinlock head_lock;
+	segment* head_seg;
+	std::size_t head_index;
+
+	// Recycled segments, linked through next.
+	cacheline_spinlock pool_lock;
+	segment* pool;
+
+	std::atomic_bool open;
+	WaitPolicy not_empty;
+
+	segmented_queue(const segmented_queue&) = delete;
+	segmented_queue& operator=(const segmented_queue&) = delete;
+
+	Alloc alloc;
+	using alloc_traits = std::allocator_traits<Alloc>;
+
+	segment* get_segment() {
+		{
+			std::lock_guard<cacheline_spinlock> l(pool_lock);
+			if (pool) {
+				segment* s = pool;
+				pool = s->next.load(std::memory_order_relaxed);
+				s->next.store(nullptr, std::memory_order_relaxed);
+				return s;
+			}
+		}
+		return new segment;
+	}
+
+	void put_segment(segment* s) {
+		s->reset();
+		std::lock_guard<cacheline_spinlock> l(pool_lock);
+		s->next.store(pool, std::memory_order_relaxed);
+		pool = s;
+	}
+
+	// Nobody can be touching a segment once all of its elements are gone
+	// and the head has stepped off it, so whoever finishes it off recycles
+	// it.
+	void retire(segment* s) {
+		if (s->retired.fetch_add(1, std::memory_order_acq_rel) ==
+		    SegmentSize)
+			put_segment(s);
+	}
+
+	// Producer side
+	T* claim_tail(segment*& seg, std::size_t& index) {
+		std::lock_guard<cacheline_spinlock> l(tail_lock);
+		if (tail_index == SegmentSize) {
+			segment* s = get_segment();
+			tail_seg->next.store(s, std::memory_order_release);
+			tail_seg = s;
+			tail_index = 0;
+		}
+		seg = tail_seg;
+		index = tail_index++;
+		return &seg->data[index];
+	}
+
+	void publish(segment* seg, std::size_t index) {
+		seg->ready[index].store(true, std::memory_order_release);
+		not_empty.notify_one();
+	}
+
+	// Consumer side
+	bool claim_head(segment*& seg, std::size_t& index) {
+		segment* finished = nullptr;
+		{
+			std::lock_guard<cacheline_spinlock> l(head_lock);
+			if (head_index == SegmentSize) {
+				segment* next = head_seg->next.load(
+					std::memory_order_acquire);
+				if (!next)
+					return false;
+				finished = head_seg;
+				head_seg = next;
+				head_index = 0;
+			}
+			if (head_seg->ready[head_index].load(
+				    std::memory_order_acquire)) {
+				seg = head_seg;
+				index = head_index++;
+			} else {
+				seg = nullptr;
+			}
+		}
+		if (finished)
+			retire(finished);
+		return seg != nullptr;
+	}
+
+	// Destroy everything from index on in seg and the segments after it,
+	// which are all ours by now.
+	void destroy_from(segment* seg, std::size_t index) {
+		while (seg) {
+			for (std::size_t i = index; i < SegmentSize; ++i)
+				if (seg->ready[i].load(std::memory_order_relaxed))
+					alloc_traits::destroy(alloc,
+							      &seg->data[i]);
+			segment* next = seg->next.load(std::memory_order_relaxed);
+			delete seg;
+			seg = next;
+			index = 0;
+		}
+	}
+
+public:
+	using value_type = T;
+	using allocator_type = Alloc;
+
+	segmented_queue() : tail_index(0), head_index(0), pool(nullptr),
+			    open(true) {
+		head_seg = tail_seg = new segment;
+	}
+	~segmented_queue() {
+		destroy_from(head_seg, head_index);
+		trim();
+	}
+
+	bool is_closed() const {
+		return !open;
+	}
+
+	void close() {
+		open = false;
+		not_empty.notify_all(); // Make sure to wake any readers
+	}
+
+	constexpr size_t segment_size() const {
+		return SegmentSize;
+	}
+
+	// Make sure the pool holds at least n segments.
+	void reserve(std::size_t n) {
+		std::lock_guard<cacheline_spinlock> l(pool_lock);
+		segment* s = pool;
+		for (; s && n; s = s->next.load(std::memory_order_relaxed))
+			--n;
+		while (n--) {
+			segment* fresh = new segment;
+			fresh->next.store(pool, std::memory_order_relaxed);
+			pool = fresh;
+		}
+	}
+
+	// Free every pooled segment.
+	void trim() {
+		segment* s;
+		{
+			std::lock_guard<cacheline_spinlock> l(pool_lock);
+			s = pool;
+			pool = nullptr;
+		}
+		while (s) {
+			segment* next = s->next.load(std::memory_order_relaxed);
+			delete s;
+			s = next;
+		}
+	}
+
+	template <class... Args>
+	void emplace(Args&&... args) {
+		segment* seg;
+		std::size_t index;
+		T* slot = claim_tail(seg, index);
+		alloc_traits::construct(alloc, slot,
+					std::forward<Args>(args)...);
+		publish(seg, index);
+	}
+
+	void push(const T& val) {
+		emplace(val);
+	}
+
+	void push(T&& val) {
+		emplace(std::move(val));
+	}
+
+	bool try_pop(T& val) {
+		segment* seg;
+		std::size_t index;
+		if (!claim_head(seg, index))
+			return false;
+		T& elem = seg->data[index];
+		val = std::move(elem);
+		alloc_traits::destroy(alloc, &elem);
+		retire(seg);
+		return true;
+	}
+
+	bool pop(T& val) {
+		bool popped = false;
+		not_empty.wait([&] {
+			return (popped = try_pop(val)) || is_closed();
+		});
+		// Anything pushed before close() is still ours to drain.
+		return popped || try_pop(val);
+	}
+};
+
+}
+#endif
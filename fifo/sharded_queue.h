@@ -0,0 +1,143 @@
+//============================================================================
+//                                  libcpp-util
+//                   A simple odds-n-ends library for C++11
+//
+//         Licensed under modified BSD license. See LICENSE for details.
+//============================================================================
+
+#ifndef LIBCPP_UTIL_SHARDED_QUEUE_H
+#define LIBCPP_UTIL_SHARDED_QUEUE_H
+
+#include "libcpp-util/fifo/concurrent_queue.h"
+#include "libcpp-util/smp/spinlock.h"
+#include "libcpp-util/smp/wait_policy.h"
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <utility>
+
+namespace cpputil {
+
+// Relaxed-FIFO multi-producer/multi-consumer queue for when there are too
+// many producers for one tail index. It is a set of bounded shards, each an
+// mpmc concurrent_queue of ShardSize elements. Every thread is given a home
+// shard the first time it touches any sharded_queue and always pushes there,
+// so producers on different shards never share a cacheline. Consumers start at
+// their own home shard and sweep the others round-robin when it's empty.
+//
+// Elements from one producer thread come out in the order it pushed them.
+// There is no order between producers, and a push() only waits for room in
+// the producer's own shard, never spilling into another one, since that would
+// break the per-producer guarantee.
+template <typename T, size_t ShardSize = 256,
+	  class WaitPolicy = futex_wait_policy<>>
+class sharded_queue {
+public:
+	using shard_type = concurrent_queue<T, ShardSize, mpmc_discipline,
+					    std::allocator<T>, WaitPolicy>;
+
+private:
+	struct slot : cacheline_aligned_new {
+		shard_type queue;
+	};
+
+	std::unique_ptr<slot[]> shard;
+	std::size_t nshards;
+
+	std::atomic_bool open;
+	WaitPolicy not_empty;
+
+	sharded_queue(const sharded_queue&) = delete;
+	sharded_queue& operator=(const sharded_queue&) = delete;
+
+	// Small, dense per-thread numbers, handed out on first use.
+	static std::size_t thread_index() {
+		static std::atomic_size_t next(0);
+		static thread_local std::size_t index =
+			next.fetch_add(1, std::memory_order_relaxed);
+		return index;
+	}
+
+	shard_type& home() {
+		return shard[thread_index() % nshards].queue;
+	}
+
+public:
+	using value_type = T;
+
+	explicit sharded_queue(
+		std::size_t shards = std::thread::hardware_concurrency())
+		: shard(new slot[shards ? shards : 1]),
+		  nshards(shards ? shards : 1), open(true) {}
+
+	std::size_t shards() const {
+		return nshards;
+	}
+
+	std::size_t capacity() const {
+		return ShardSize * nshards;
+	}
+
+	bool is_closed() const {
+		return !open.load(std::memory_order_acquire);
+	}
+
+	void close() {
+		open.store(false, std::memory_order_release);
+		not_empty.notify_all();
+	}
+
+	template <class... Args>
+	void emplace(Args&&... args) {
+		home().emplace(std::forward<Args>(args)...);
+		not_empty.notify_one();
+	}
+
+	void push(const T& val) {
+		emplace(val);
+	}
+
+	void push(T&& val) {
+		emplace(std::move(val));
+	}
+
+	template <class... Args>
+	bool try_emplace(Args&&... args) {
+		if (!home().try_emplace(std::forward<Args>(args)...))
+			return false;
+		not_empty.notify_one();
+		return true;
+	}
+
+	bool try_push(const T& val) {
+		return try_emplace(val);
+	}
+
+	bool try_push(T&& val) {
+		return try_emplace(std::move(val));
+	}
+
+	bool try_pop(T& val) {
+		std::size_t start = thread_index();
+		for (std::size_t i = 0; i < nshards; ++i) {
+			if (shard[(start + i) % nshards].queue.try_pop(val))
+				return true;
+		}
+		return false;
+	}
+
+	// Returns false once the queue is closed and every shard is drained.
+	bool pop(T& val) {
+		bool popped = false;
+		not_empty.wait([&] {
+			return (popped = try_pop(val)) || is_closed();
+		});
+		// Anything pushed before close() is still ours to drain.
+		return popped || try_pop(val);
+	}
+};
+
+}
+#endif
@@ -0,0 +1,237 @@
+//============================================================================
+//                                  libcpp-util
+//                   A simple odds-n-ends library for C++11
+//
+//         Licensed under modified BSD license. See LICENSE for details.
+//============================================================================
+
+#ifndef LIBCPP_UTIL_SHM_QUEUE_H
+#define LIBCPP_UTIL_SHM_QUEUE_H
+
+#include "libcpp-util/fifo/concurrent_queue.h"
+#include "libcpp-util/smp/wait_policy.h"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <new>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace cpputil {
+
+enum class shm_open_mode {
+	create,
+	attach
+};
+
+// A concurrent_queue living in shared memory, so that separate processes can
+// pass messages without the kernel on the fast path. Everything the queue
+// needs (slots, indices, the closed flag and the wait policy's futex words) is
+// inside the mapping and position-independent; only blocking goes through a
+// process-shared futex.
+//
+// Elements must be trivially copyable, since they are just bytes to the other
+// process, and WaitPolicy must be process-shared: shared_futex_wait_policy, or
+// one of the spinning policies. Each side maps the queue with its own
+// shm_queue and uses it through -> like a pointer. The creator initializes
+// the queue; attaching waits for that to finish, for up to attach_timeout,
+// and then fails with ETIMEDOUT, in case the creator died before it got
+// there.
+//
+// The mapping is named (shm_open) or comes from a file descriptor the two
+// processes share, e.g. a memfd inherited across fork() or passed over a
+// Unix socket. Failures throw std::system_error.
+template <typename T, size_t N, class AtomicPolicy = spsc_discipline,
+	  class WaitPolicy = shared_futex_wait_policy<>>
+class shm_queue {
+	static_assert(std::is_trivially_copyable<T>::value,
+		      "shm_queue elements must be trivially copyable");
+	static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+		      "shm_queue needs address-free atomics");
+
+public:
+	using queue_type = concurrent_queue<T, N, AtomicPolicy,
+					    std::allocator<T>, WaitPolicy>;
+
+private:
+	struct header {
+		// Written last by the creator, so attaching sees a ready
+		// queue once it reads the right magic.
+		std::atomic<std::uint64_t> magic;
+		std::uint64_t size;
+	};
+
+	struct layout {
+		header h;
+		queue_type queue;
+	};
+
+	static constexpr std::uint64_t ready_magic = 0x6370757469717565ULL;
+
+	int fd;
+	layout* mem;
+	std::string name;
+
+	shm_queue(const shm_queue&) = delete;
+	shm_queue& operator=(const shm_queue&) = delete;
+
+	static void fail(const char* what) {
+		throw std::system_error(errno, std::system_category(), what);
+	}
+
+	static void wait_a_bit(std::chrono::steady_clock::time_point deadline) {
+		if (std::chrono::steady_clock::now() > deadline) {
+			errno = ETIMEDOUT;
+			fail("shm_queue attach");
+		}
+		std::this_thread::yield();
+	}
+
+	void map(shm_open_mode mode, std::chrono::milliseconds timeout) {
+		auto deadline = std::chrono::steady_clock::now() + timeout;
+		if (mode == shm_open_mode::create) {
+			if (ftruncate(fd, sizeof(layout)) == -1)
+				fail("ftruncate");
+		} else {
+			// The creator might not have sized it yet.
+			while (1) {
+				struct stat st;
+				if (fstat(fd, &st) == -1)
+					fail("fstat");
+				if (st.st_size >= off_t(sizeof(layout)))
+					break;
+				wait_a_bit(deadline);
+			}
+		}
+
+		void* p = mmap(nullptr, sizeof(layout), PROT_READ | PROT_WRITE,
+			       MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED)
+			fail("mmap");
+		mem = static_cast<layout*>(p);
+
+		if (mode == shm_open_mode::create) {
+			mem->h.size = sizeof(layout);
+			::new (&mem->queue) queue_type;
+			mem->h.magic.store(ready_magic, std::memory_order_release);
+		} else {
+			while (mem->h.magic.load(std::memory_order_acquire) !=
+			       ready_magic)
+				wait_a_bit(deadline);
+			if (mem->h.size != sizeof(layout)) {
+				errno = EINVAL;
+				fail("shm_queue layout mismatch");
+			}
+		}
+	}
+
+	void unmap() {
+		if (mem)
+			munmap(mem, sizeof(layout));
+		if (fd != -1)
+			close(fd);
+	}
+
+public:
+	static constexpr std::chrono::milliseconds default_attach_timeout{5000};
+
+	// Named queue under /dev/shm. The creator unlinks the name when it
+	// goes away; processes already attached keep working.
+	shm_queue(const char* shm_name, shm_open_mode mode,
+		  std::chrono::milliseconds attach_timeout =
+			  default_attach_timeout)
+		: fd(-1), mem(nullptr) {
+		int flags = mode == shm_open_mode::create
+				    ? O_RDWR | O_CREAT | O_EXCL
+				    : O_RDWR;
+		fd = shm_open(shm_name, flags, 0600);
+		if (fd == -1)
+			fail("shm_open");
+		if (mode == shm_open_mode::create)
+			name = shm_name;
+		try {
+			map(mode, attach_timeout);
+		} catch (...) {
+			unmap();
+			if (!name.empty())
+				shm_unlink(name.c_str());
+			throw;
+		}
+	}
+
+	// Queue in a file the caller already opened. Takes ownership of fd.
+	shm_queue(int file, shm_open_mode mode,
+		  std::chrono::milliseconds attach_timeout =
+			  default_attach_timeout)
+		: fd(file), mem(nullptr) {
+		try {
+			map(mode, attach_timeout);
+		} catch (...) {
+			unmap();
+			throw;
+		}
+	}
+
+#ifdef __linux__
+	// Anonymous queue in a fresh memfd. Share it by handing
+	// file_descriptor() to the other process, then attaching with the fd
+	// constructor there.
+	shm_queue() : fd(-1), mem(nullptr) {
+		fd = memfd_create("cpputil-shm-queue", 0);
+		if (fd == -1)
+			fail("memfd_create");
+		try {
+			map(shm_open_mode::create, default_attach_timeout);
+		} catch (...) {
+			unmap();
+			throw;
+		}
+	}
+#endif
+
+	shm_queue(shm_queue&& o) noexcept
+		: fd(o.fd), mem(o.mem), name(std::move(o.name)) {
+		o.fd = -1;
+		o.mem = nullptr;
+		o.name.clear();
+	}
+
+	// Elements are trivially destructible, so there's nothing to tear
+	// down in the mapping itself.
+	~shm_queue() {
+		unmap();
+		if (!name.empty())
+			shm_unlink(name.c_str());
+	}
+
+	int file_descriptor() const {
+		return fd;
+	}
+
+	queue_type& operator*() const {
+		return mem->queue;
+	}
+
+	queue_type* operator->() const {
+		return &mem->queue;
+	}
+};
+
+template <typename T, size_t N, class AtomicPolicy, class WaitPolicy>
+constexpr std::uint64_t shm_queue<T, N, AtomicPolicy, WaitPolicy>::ready_magic;
+
+template <typename T, size_t N, class AtomicPolicy, class WaitPolicy>
+constexpr std::chrono::milliseconds
+	shm_queue<T, N, AtomicPolicy, WaitPolicy>::default_attach_timeout;
+
+}
+#endif
@@ -0,0 +1,150 @@
+//============================================================================
+//                                  libcpp-util
+//                   A simple odds-n-ends library for C++11
+//
+//         Licensed under modified BSD license. See LICENSE for details.
+//============================================================================
+
+#ifndef LIBCPP_UTIL_WORK_STEALING_DEQUE_H
+#define LIBCPP_UTIL_WORK_STEALING_DEQUE_H
+
+#include "libcpp-util/smp/spinlock.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace cpputil {
+
+// Chase-Lev work-stealing deque, with the memory orderings from Le et al.,
+// "Correct and Efficient Work-Stealing for Weak Memory Models" (PPoPP '13).
+// One owner thread pushes and takes at the bottom like a stack; any number of
+// thieves steal from the top. The owner only synchronizes with thieves when
+// they are fighting over the last element.
+//
+// Elements live in std::atomic slots, so T should be small and trivially
+// copyable; pointers to tasks are the intended use. The array grows when the
+// owner runs out of room. Old arrays are kept until the deque dies since a
+// thief may still be reading from one.
+template <typename T>
+class work_stealing_deque : public cacheline_aligned_new {
+	static_assert(std::is_trivially_copyable<T>::value,
+		      "work_stealing_deque elements must be trivially copyable");
+
+private:
+	struct array {
+		std::int64_t mask;
+		std::unique_ptr<std::atomic<T>[]> items;
+
+		explicit array(std::int64_t capacity)
+			: mask(capacity - 1), items(new std::atomic<T>[capacity]) {}
+
+		std::int64_t capacity() const {
+			return mask + 1;
+		}
+
+		T get(std::int64_t i) const {
+			return items[i & mask].load(std::memory_order_relaxed);
+		}
+
+		void put(std::int64_t i, T val) {
+			items[i & mask].store(val, std::memory_order_relaxed);
+		}
+	};
+
+	// Thieves CAS top while the owner moves bottom, so each gets a line.
+	alignas(cacheline_size) std::atomic<std::int64_t> top;
+	alignas(cacheline_size) std::atomic<std::int64_t> bottom;
+	std::atomic<array*> buffer;
+	// Owner-only. The live array is always the last one.
+	std::vector<std::unique_ptr<array>> arrays;
+
+	work_stealing_deque(const work_stealing_deque&) = delete;
+	work_stealing_deque& operator=(const work_stealing_deque&) = delete;
+
+	array* grow(array* a, std::int64_t b, std::int64_t t) {
+		std::unique_ptr<array> bigger(new array(a->capacity() * 2));
+		for (std::int64_t i = t; i < b; ++i)
+			bigger->put(i, a->get(i));
+		array* ret = bigger.get();
+		arrays.push_back(std::move(bigger));
+		buffer.store(ret, std::memory_order_release);
+		return ret;
+	}
+
+public:
+	using value_type = T;
+
+	// capacity must be a power of two.
+	explicit work_stealing_deque(std::size_t capacity = 64)
+		: top(0), bottom(0) {
+		arrays.emplace_back(new array(capacity));
+		buffer.store(arrays.back().get(), std::memory_order_relaxed);
+	}
+	~work_stealing_deque() = default;
+
+	// Only a hint when called by anyone but the owner.
+	bool empty() const {
+		return bottom.load(std::memory_order_relaxed) <=
+		       top.load(std::memory_order_relaxed);
+	}
+
+	// Owner only.
+	void push(T val) {
+		std::int64_t b = bottom.load(std::memory_order_relaxed);
+		std::int64_t t = top.load(std::memory_order_acquire);
+		array* a = buffer.load(std::memory_order_relaxed);
+		if (b - t > a->capacity() - 1)
+			a = grow(a, b, t);
+		a->put(b, val);
+		bottom.store(b + 1, std::memory_order_release);
+	}
+
+	// Owner only. Takes the most recently pushed element.
+	bool take(T& val) {
+		std::int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+		array* a = buffer.load(std::memory_order_relaxed);
+		bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		std::int64_t t = top.load(std::memory_order_relaxed);
+		if (t > b) {
+			// Empty
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return false;
+		}
+		val = a->get(b);
+		if (t == b) {
+			// Last element; race the thieves for it.
+			bool won = top.compare_exchange_strong(
+				t, t + 1, std::memory_order_seq_cst,
+				std::memory_order_relaxed);
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return won;
+		}
+		return true;
+	}
+
+	// Any thread. Takes the oldest element. Fails when the deque is empty
+	// or another thread won the race for the element.
+	bool steal(T& val) {
+		std::int64_t t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		std::int64_t b = bottom.load(std::memory_order_acquire);
+		if (t >= b)
+			return false;
+		array* a = buffer.load(std::memory_order_acquire);
+		T tmp = a->get(t);
+		if (!top.compare_exchange_strong(t, t + 1,
+						 std::memory_order_seq_cst,
+						 std::memory_order_relaxed))
+			return false;
+		val = tmp;
+		return true;
+	}
+};
+
+}
+#endif
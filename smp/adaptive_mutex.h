@@ -0,0 +1,170 @@
+//============================================================================
+//                                  libcpp-util
+//                   A simple odds-n-ends library for C++11
+//
+//         Licensed under modified BSD license. See LICENSE for details.
+//============================================================================
+
+#ifndef LIBCPP_UTIL_ADAPTIVE_MUTEX_H
+#define LIBCPP_UTIL_ADAPTIVE_MUTEX_H
+
+#include "libcpp-util/smp/futex.h"
+#include "libcpp-util/smp/spinlock.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+namespace cpputil {
+
+// Mutex that spins for a while before sleeping on a futex, and learns how long
+// the while should be. Short critical sections are usually over before a
+// waiter would have finished going to sleep, so spinning wins; long ones (or
+// a preempted holder) make spinning a waste, so it gives up and parks.
+//
+// Everything lives in one 4-byte word, small enough to put in every object:
+//
+//	bits 0-1	0 unlocked, 1 locked, 2 locked and somebody may be asleep
+//	bits 8-31	spin budget estimate
+//
+// The locking protocol is the usual three-state futex mutex (Drepper,
+// "Futexes Are Tricky"), so unlock() only makes a syscall when someone might be
+// parked. The estimate is nudged by each thread that had to wait, towards
+// twice the spins it needed if spinning got it the lock, or towards nothing if
+// it ended up asleep. It stays between nothing and max_spins, and waiters
+// always spin for at least a small floor anyway, so the lock keeps finding
+// out when spinning starts paying off again.
+class adaptive_mutex {
+private:
+	enum : int {
+		unlocked = 0,
+		locked = 1,
+		contended = 2,
+		state_mask = 3,
+		budget_shift = 8,
+		budget_unit = 1 << budget_shift,
+		min_spins = 16,
+		max_spins = 1 << 14
+	};
+
+	std::atomic<int> word;
+
+	adaptive_mutex(const adaptive_mutex&) = delete;
+	adaptive_mutex& operator=(const adaptive_mutex&) = delete;
+
+	static int state(int w) {
+		return w & state_mask;
+	}
+
+	// Try to go from unlocked to to, keeping the budget bits.
+	bool acquire(int& w, int to) {
+		return state(w) == unlocked &&
+		       word.compare_exchange_weak(w, w | to,
+						  std::memory_order_acquire,
+						  std::memory_order_relaxed);
+	}
+
+	// Move the estimate an eighth of the way to target, from whatever it
+	// is now rather than what this waiter saw on the way in, so racing
+	// updates can't carry it out of range. Only the bits above the state
+	// change, so this can't disturb anyone's CAS on them other than
+	// making it retry.
+	void adapt(int target) {
+		int w = word.load(std::memory_order_relaxed);
+		while (1) {
+			int estimate = w >> budget_shift;
+			int next = estimate + (target - estimate) / 8;
+			if (next == estimate)
+				return;
+			if (word.compare_exchange_weak(
+				    w, next * budget_unit | state(w),
+				    std::memory_order_relaxed))
+				return;
+		}
+	}
+
+	void lock_slow() {
+		int w = word.load(std::memory_order_relaxed);
+		int estimate = w >> budget_shift;
+		int limit = estimate > min_spins ? estimate : min_spins;
+
+		for (int spins = 1; spins <= limit; ++spins) {
+			cpu_relax();
+			w = word.load(std::memory_order_relaxed);
+			if (state(w) == contended)
+				break; // Others are already parked
+			if (acquire(w, locked)) {
+				int target = 2 * spins;
+				adapt(target < max_spins ? target : max_spins);
+				return;
+			}
+		}
+
+		adapt(0);
+		// From here on we have to assume there are others asleep, so
+		// the lock is taken as contended.
+		w = word.load(std::memory_order_relaxed);
+		while (1) {
+			if (acquire(w, contended))
+				return;
+			if (state(w) == unlocked)
+				continue;
+			int sleeping = (w & ~state_mask) | contended;
+			if (state(w) == contended ||
+			    word.compare_exchange_weak(w, sleeping,
+						       std::memory_order_relaxed))
+				futex_wait(word, sleeping);
+			w = word.load(std::memory_order_relaxed);
+		}
+	}
+
+public:
+	adaptive_mutex() : word(64 * budget_unit | unlocked) {}
+	~adaptive_mutex() = default;
+
+	void lock() {
+		int w = word.load(std::memory_order_relaxed);
+		if (!acquire(w, locked))
+			lock_slow();
+	}
+
+	bool try_lock() {
+		int w = word.load(std::memory_order_relaxed);
+		while (state(w) == unlocked) {
+			if (acquire(w, locked))
+				return true;
+		}
+		return false;
+	}
+
+	template <class Rep, class Period>
+	bool try_lock_for(const std::chrono::duration<Rep,Period>& duration) {
+		return try_lock_until(
+				std::chrono::steady_clock::now() + duration);
+	}
+
+	// futex_wait has no timeout, so timed waiters never park; they poll,
+	// yielding between tries.
+	template <class Clock, class Duration>
+	bool try_lock_until(
+			const std::chrono::time_point<Clock, Duration>& when) {
+		while (when > Clock::now()) {
+			if (try_lock())
+				return true;
+			std::this_thread::yield();
+		}
+		return false; // Time elapsed
+	}
+
+	void unlock() {
+		int prev = word.fetch_and(~state_mask, std::memory_order_release);
+		if (state(prev) == contended)
+			futex_wake(word, 1);
+	}
+};
+
+static_assert(sizeof(adaptive_mutex) == 4,
+	      "adaptive_mutex should be a single 4-byte word");
+
+}
+#endif
@@ -0,0 +1,59 @@
+//============================================================================
+//                                  libcpp-util
+//                   A simple odds-n-ends library for C++11
+//
+//         Licensed under modified BSD license. See LICENSE for details.
+//============================================================================
+
+#ifndef LIBCPP_UTIL_ATOMIC_WORDS_H
+#define LIBCPP_UTIL_ATOMIC_WORDS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace cpputil {
+
+// Storage for a T that one thread may be copying in while others copy it
+// out, as behind a sequence number. It's copied a word at a time through
+// relaxed atomics, which keeps the racing copies defined, so T has to be
+// trivially copyable. A copy that raced with a store can be torn; the caller
+// orders the copies with fences and throws torn ones away.
+template <typename T>
+class atomic_words {
+	static_assert(std::is_trivially_copyable<T>::value,
+		      "atomic_words values must be trivially copyable");
+
+private:
+	using word = std::uintptr_t;
+	static constexpr size_t words = (sizeof(T) + sizeof(word) - 1) /
+					sizeof(word);
+
+	std::atomic<word> data[words];
+
+public:
+	void store(const T& val) {
+		word copy[words] = {};
+		std::memcpy(copy, &val, sizeof(T));
+		for (size_t i = 0; i < words; ++i)
+			data[i].store(copy[i], std::memory_order_relaxed);
+	}
+
+	T load() const {
+		word copy[words];
+		for (size_t i = 0; i < words; ++i)
+			copy[i] = data[i].load(std::memory_order_relaxed);
+		// T needn't be default constructible.
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type val;
+		std::memcpy(&val, copy, sizeof(T));
+		return reinterpret_cast<const T&>(val);
+	}
+};
+
+template <typename T>
+constexpr size_t atomic_words<T>::words;
+
+}
+#endif
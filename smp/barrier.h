@@ -0,0 +1,182 @@
+//============================================================================
+//                                  libcpp-util
+//                   A simple odds-n-ends library for C++11
+//
+//         Licensed under modified BSD license. See LICENSE for details.
+//============================================================================
+
+#ifndef LIBCPP_UTIL_BARRIER_H
+#define LIBCPP_UTIL_BARRIER_H
+
+#include "libcpp-util/smp/spinlock.h"
+#include "libcpp-util/smp/wait_policy.h"
+
+#include <atomic>
+#include <memory>
+
+namespace cpputil {
+
+// Counts arrivals of n participants, numbered 0 to n-1, without a single
+// counter they all hit. Participants arrive at a leaf shared with up to
+// fanin-1 others, and only the last one to arrive at a node carries on to its
+// parent, so each counter sees at most fanin arrivals per round and the last
+// participant in climbs log_fanin(n) levels.
+//
+// The last to leave a node resets it on the way up, so the tree is ready for
+// the next round by the time the root completes.
+class combining_tree {
+private:
+	// A cacheline each, so arrivals at different nodes don't disturb each
+	// other.
+	struct alignas(cacheline_size) node : cacheline_aligned_new {
+		std::atomic<unsigned> count;
+		unsigned expected;
+		unsigned parent;
+	};
+	static_assert(sizeof(node) == cacheline_size,
+		      "combining_tree nodes should be a cacheline each");
+
+	enum : unsigned { root = ~0u };
+
+	unsigned fanin;
+	std::unique_ptr<node[]> nodes;
+
+	combining_tree(const combining_tree&) = delete;
+	combining_tree& operator=(const combining_tree&) = delete;
+
+	static unsigned groups(unsigned n, unsigned fanin) {
+		return (n + fanin - 1) / fanin;
+	}
+
+public:
+	explicit combining_tree(unsigned n, unsigned fanin = 4)
+		: fanin(fanin < 2 ? 2 : fanin) {
+		if (!n)
+			n = 1;
+		unsigned total = 0;
+		for (unsigned width = n; width > 1; ) {
+			width = groups(width, this->fanin);
+			total += width;
+		}
+		nodes.reset(new node[total ? total : 1]);
+
+		// The leaves come first, then each level's parents after it.
+		unsigned children = n;
+		unsigned begin = 0;
+		unsigned width = groups(n, this->fanin);
+		while (1) {
+			for (unsigned i = 0; i < width; ++i) {
+				node& nd = nodes[begin + i];
+				unsigned left = children - i * this->fanin;
+				nd.count.store(0, std::memory_order_relaxed);
+				nd.expected = left < this->fanin ? left :
+								   this->fanin;
+				nd.parent = width == 1 ?
+					root : begin + width + i / this->fanin;
+			}
+			if (width == 1)
+				break;
+			children = width;
+			begin += width;
+			width = groups(width, this->fanin);
+		}
+	}
+
+	// Returns true for the last participant to arrive in this round,
+	// which is the one to let everybody go.
+	bool arrive(unsigned id) {
+		unsigned i = id / fanin;
+		while (1) {
+			node& nd = nodes[i];
+			if (nd.count.fetch_add(1, std::memory_order_acq_rel) + 1 !=
+			    nd.expected)
+				return false;
+			nd.count.store(0, std::memory_order_relaxed);
+			if (nd.parent == root)
+				return true;
+			i = nd.parent;
+		}
+	}
+};
+
+// Reusable barrier for a fixed set of n threads, each of which passes its own
+// number to arrive_and_wait() every round. Arrivals are combined up a tree
+// rather than counted on one hot word; the last one in flips the barrier's
+// sense, and everyone else waits for it to flip with the WaitPolicy, which
+// by default spins for a while before parking on a futex.
+//
+// The sense is a round counter rather than a single bit, so nobody needs to
+// remember which way it pointed last time: a waiter just waits for it to move
+// on from the value it saw on arrival, which can't change before then.
+template <class WaitPolicy = futex_wait_policy<>>
+class spin_barrier {
+private:
+	combining_tree tree;
+	std::atomic<unsigned> sense;
+	WaitPolicy waiting;
+
+	spin_barrier(const spin_barrier&) = delete;
+	spin_barrier& operator=(const spin_barrier&) = delete;
+
+public:
+	explicit spin_barrier(unsigned n, unsigned fanin = 4)
+		: tree(n, fanin), sense(0) {}
+	~spin_barrier() = default;
+
+	// Returns true in exactly one of the threads every round, like
+	// PTHREAD_BARRIER_SERIAL_THREAD.
+	bool arrive_and_wait(unsigned id) {
+		unsigned round = sense.load(std::memory_order_acquire);
+		if (tree.arrive(id)) {
+			sense.store(round + 1, std::memory_order_release);
+			waiting.notify_all();
+			return true;
+		}
+		waiting.wait([&] {
+			return sense.load(std::memory_order_acquire) != round;
+		});
+		return false;
+	}
+};
+
+// Single-use latch that opens once each of n participants, numbered 0 to
+// n-1, has counted down once. Anyone can wait for it, participant or not.
+// Count downs are combined as in spin_barrier.
+template <class WaitPolicy = futex_wait_policy<>>
+class countdown_latch {
+private:
+	combining_tree tree;
+	std::atomic_bool open;
+	WaitPolicy waiting;
+
+	countdown_latch(const countdown_latch&) = delete;
+	countdown_latch& operator=(const countdown_latch&) = delete;
+
+public:
+	explicit countdown_latch(unsigned n, unsigned fanin = 4)
+		: tree(n, fanin), open(n == 0) {}
+	~countdown_latch() = default;
+
+	void count_down(unsigned id) {
+		if (tree.arrive(id)) {
+			open.store(true, std::memory_order_release);
+			waiting.notify_all();
+		}
+	}
+
+	bool try_wait() const {
+		return open.load(std::memory_order_acquire);
+	}
+
+	void wait() {
+		waiting.wait([this] { return try_wait(); });
+	}
+
+	void arrive_and_wait(unsigned id) {
+		count_down(id);
+		wait();
+	}
+};
+
+}
+#endif
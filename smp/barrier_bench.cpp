@@ -0,0 +1,119 @@
+// Time per round of spin_barrier, with each wait policy and a few fan-ins,
+// against a plain mutex and condition variable barrier, across thread counts.
+//
+// Usage: barrier_bench [rounds] [--pin]
+//
+// --pin pins thread i to CPU i (mod the number of CPUs).
+#include "barrier.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace cpputil;
+using bench_clock = std::chrono::steady_clock;
+
+static unsigned rounds = 20000;
+static bool pin = false;
+
+static void pin_thread(unsigned index) {
+#ifdef __linux__
+	if (!pin)
+		return;
+	unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(index % cpus, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+	(void)index;
+#endif
+}
+
+// The barrier everyone writes first: one counter and one condition variable
+// under one mutex.
+class condvar_barrier {
+private:
+	std::mutex m;
+	std::condition_variable cv;
+	unsigned n;
+	unsigned arrived;
+	unsigned round;
+
+public:
+	condvar_barrier(unsigned n, unsigned) : n(n), arrived(0), round(0) {}
+
+	bool arrive_and_wait(unsigned) {
+		std::unique_lock<std::mutex> lock(m);
+		unsigned mine = round;
+		if (++arrived == n) {
+			arrived = 0;
+			++round;
+			cv.notify_all();
+			return true;
+		}
+		cv.wait(lock, [&] { return round != mine; });
+		return false;
+	}
+};
+
+template <class Barrier>
+void run(const char* name, unsigned threads, unsigned fanin) {
+	Barrier barrier(threads, fanin);
+	std::vector<std::thread> workers;
+
+	auto start = bench_clock::now();
+	for (unsigned t = 0; t < threads; ++t) {
+		workers.emplace_back([&, t] {
+			pin_thread(t);
+			for (unsigned r = 0; r < rounds; ++r)
+				barrier.arrive_and_wait(t);
+		});
+	}
+	for (auto& w : workers)
+		w.join();
+	std::chrono::duration<double, std::nano> elapsed =
+		bench_clock::now() - start;
+
+	printf("%-10s %3u %5u %12.1f\n", name, threads, fanin,
+	       elapsed.count() / rounds);
+	fflush(stdout);
+}
+
+template <class Barrier>
+void sweep(const char* name, unsigned fanin) {
+	static const unsigned counts[] = {2, 4, 8, 16, 32};
+	for (unsigned t : counts)
+		run<Barrier>(name, t, fanin);
+}
+
+int main(int argc, char* argv[]) {
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--pin"))
+			pin = true;
+		else
+			rounds = std::stoi(argv[i]);
+	}
+
+	printf("%-10s %3s %5s %12s\n", "barrier", "T", "fanin", "ns/round");
+	sweep<condvar_barrier>("condvar", 0);
+	sweep<spin_barrier<futex_wait_policy<>>>("futex", 2);
+	sweep<spin_barrier<futex_wait_policy<>>>("futex", 4);
+	sweep<spin_barrier<futex_wait_policy<>>>("futex", 8);
+	sweep<spin_barrier<yield_wait_policy<>>>("yield", 4);
+	// Spinning only makes sense with a core per thread.
+	if (pin)
+		sweep<spin_barrier<spin_wait_policy>>("spin", 4);
+	return 0;
+}
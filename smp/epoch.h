@@ -0,0 +1,309 @@
+//============================================================================
+//                                  libcpp-util
+//                   A simple odds-n-ends library for C++11
+//
+//         Licensed under modified BSD license. See LICENSE for details.
+//============================================================================
+
+#ifndef LIBCPP_UTIL_EPOCH_H
+#define LIBCPP_UTIL_EPOCH_H
+
+#include "libcpp-util/smp/spinlock.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cpputil {
+
+// Epoch-based reclamation, for freeing the nodes of lock-free structures that
+// readers might still be looking at.
+//
+// Readers wrap every access to the structure in an epoch_guard. Entering one
+// announces the global epoch the thread saw on the way in; leaving it
+// announces nothing. Writers unlink a node as usual and hand it to retire()
+// instead of deleting it, which puts it on the calling thread's limbo list
+// tagged with the current epoch.
+//
+// The epoch only moves on once every thread inside a guard has announced the
+// current one, so by the time it has moved on twice since a node was retired,
+// every guard that was open when it was unlinked has been left, and nobody
+// can still hold a pointer to it. Each thread frees the nodes on its own limbo
+// list that are that old every so often as it retires more, and drain() does
+// the same on demand. Nobody else touches a thread's limbo list while it's
+// running, so what it has retired waits for it to retire more, call drain()
+// or exit.
+//
+// Entering and leaving cost a store and a fence on a line only the thread
+// itself writes; the readers never write anything shared. A thread that stays
+// inside a guard holds up reclamation for everybody, though.
+//
+// Each thread that uses a domain gets a record in it, which it keeps until it
+// exits. Nodes still in limbo then pass to the domain, and the record to the
+// next thread that needs one. A domain has to outlive every thread that has
+// used it; global() is one that lives as long as the process.
+class epoch_domain : public cacheline_aligned_new {
+private:
+	struct retired {
+		void* ptr;
+		void (*deleter)(void*);
+		std::uint64_t epoch;
+	};
+
+	// Announced epoch shifted left by one, with the low bit set while
+	// inside a guard. It has a cacheline to itself, so that announcing
+	// doesn't disturb the neighbouring records or anyone walking the list.
+	struct alignas(cacheline_size) participant : cacheline_aligned_new {
+		std::atomic<std::uint64_t> local;
+		// Only touched by the thread that owns the record.
+		alignas(cacheline_size) unsigned nesting;
+		unsigned since_collect;
+		std::vector<retired> limbo;
+		epoch_domain* domain;
+		participant* thread_next;
+		// Set while some thread owns the record.
+		std::atomic_bool in_use;
+		participant* next;
+	};
+
+	// The records a thread owns, one per domain it has used, given back
+	// when it exits.
+	struct thread_participants {
+		participant* head = nullptr;
+
+		~thread_participants() {
+			while (head) {
+				participant* p = head;
+				head = p->thread_next;
+				p->domain->release(p);
+			}
+		}
+	};
+
+	static constexpr unsigned collect_interval = 64;
+
+	// Read on every enter(), so it gets a line to itself.
+	alignas(cacheline_size) std::atomic<std::uint64_t> epoch;
+	alignas(cacheline_size) std::atomic<participant*> participants;
+	// Limbo lists of threads that have exited.
+	spinlock orphans_lock;
+	std::vector<retired> orphans;
+
+	epoch_domain(const epoch_domain&) = delete;
+	epoch_domain& operator=(const epoch_domain&) = delete;
+
+	friend class epoch_guard;
+
+	static thread_participants& mine() {
+		static thread_local thread_participants t;
+		return t;
+	}
+
+	participant* local() {
+		thread_participants& t = mine();
+		for (participant* p = t.head; p; p = p->thread_next) {
+			if (p->domain == this)
+				return p;
+		}
+		participant* p = acquire();
+		p->thread_next = t.head;
+		t.head = p;
+		return p;
+	}
+
+	// Reuse a record some exited thread gave back, or add a new one.
+	// Records are never unlinked, so the list can be walked without a lock.
+	participant* acquire() {
+		for (participant* p = participants.load(std::memory_order_acquire);
+		     p; p = p->next) {
+			if (!p->in_use.load(std::memory_order_relaxed) &&
+			    !p->in_use.exchange(true, std::memory_order_acquire))
+				return p;
+		}
+		participant* p = new participant;
+		p->local.store(0, std::memory_order_relaxed);
+		p->nesting = 0;
+		p->since_collect = 0;
+		p->domain = this;
+		p->in_use.store(true, std::memory_order_relaxed);
+		p->next = participants.load(std::memory_order_relaxed);
+		while (!participants.compare_exchange_weak(
+				p->next, p, std::memory_order_release,
+				std::memory_order_relaxed))
+			;
+		return p;
+	}
+
+	void release(participant* p) {
+		if (!p->limbo.empty()) {
+			std::lock_guard<spinlock> lock(orphans_lock);
+			orphans.insert(orphans.end(), p->limbo.begin(),
+				       p->limbo.end());
+		}
+		p->limbo.clear();
+		p->limbo.shrink_to_fit();
+		p->in_use.store(false, std::memory_order_release);
+	}
+
+	void enter(participant* p) {
+		if (p->nesting++)
+			return;
+		std::uint64_t e = epoch.load(std::memory_order_relaxed);
+		p->local.store(e << 1 | 1, std::memory_order_relaxed);
+		// The announcement has to be visible before anything the
+		// guard protects is read.
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+	}
+
+	void exit(participant* p) {
+		if (--p->nesting)
+			return;
+		p->local.store(0, std::memory_order_release);
+	}
+
+	// Moves the epoch on if every thread inside a guard has seen the
+	// current one.
+	bool try_advance() {
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		std::uint64_t e = epoch.load(std::memory_order_relaxed);
+		for (participant* p = participants.load(std::memory_order_acquire);
+		     p; p = p->next) {
+			std::uint64_t l = p->local.load(std::memory_order_acquire);
+			if ((l & 1) && (l >> 1) != e)
+				return false;
+		}
+		return epoch.compare_exchange_strong(e, e + 1,
+						     std::memory_order_acq_rel,
+						     std::memory_order_relaxed);
+	}
+
+	// Frees the front of the list, whose entries are in epoch order, as
+	// far as it is safe to.
+	static void free_expired(std::vector<retired>& list, std::uint64_t e) {
+		size_t n = 0;
+		while (n < list.size() && list[n].epoch + 2 <= e)
+			++n;
+		std::vector<retired> expired(list.begin(), list.begin() + n);
+		list.erase(list.begin(), list.begin() + n);
+		for (auto& r : expired)
+			r.deleter(r.ptr);
+	}
+
+	void collect(participant* p) {
+		std::uint64_t e = epoch.load(std::memory_order_acquire);
+		free_expired(p->limbo, e);
+
+		std::vector<retired> expired;
+		{
+			std::lock_guard<spinlock> lock(orphans_lock);
+			if (orphans.empty())
+				return;
+			// Orphans come from several threads, so they aren't in
+			// order.
+			auto keep = orphans.begin();
+			for (auto& r : orphans) {
+				if (r.epoch + 2 <= e)
+					expired.push_back(r);
+				else
+					*keep++ = r;
+			}
+			orphans.erase(keep, orphans.end());
+		}
+		for (auto& r : expired)
+			r.deleter(r.ptr);
+	}
+
+public:
+	epoch_domain() : epoch(0), participants(nullptr) {}
+
+	// Only once every thread but this one is done with the domain; frees
+	// everything still in limbo.
+	~epoch_domain() {
+		thread_participants& t = mine();
+		for (participant** p = &t.head; *p; p = &(*p)->thread_next) {
+			if ((*p)->domain == this) {
+				*p = (*p)->thread_next;
+				break;
+			}
+		}
+		participant* p = participants.load(std::memory_order_acquire);
+		while (p) {
+			for (auto& r : p->limbo)
+				r.deleter(r.ptr);
+			participant* next = p->next;
+			delete p;
+			p = next;
+		}
+		for (auto& r : orphans)
+			r.deleter(r.ptr);
+	}
+
+	static epoch_domain& global() {
+		static epoch_domain* d = new epoch_domain;
+		return *d;
+	}
+
+	// Hands ptr over to be deleted once no guard can still see it. It must
+	// already be unreachable for anyone entering a guard from now on.
+	template <typename T>
+	void retire(T* ptr) {
+		retire(ptr, [](void* p) { delete static_cast<T*>(p); });
+	}
+
+	void retire(void* ptr, void (*deleter)(void*)) {
+		participant* p = local();
+		enter(p);
+		p->limbo.push_back(
+			retired{ptr, deleter,
+				epoch.load(std::memory_order_relaxed)});
+		exit(p);
+		if (++p->since_collect >= collect_interval) {
+			p->since_collect = 0;
+			try_advance();
+			collect(p);
+		}
+	}
+
+	// Waits for every guard open now to be left, and frees whatever that
+	// makes safe to of what the calling thread retired and what threads
+	// that have exited left behind. Other running threads' nodes stay in
+	// their limbo lists. Not from inside a guard, which would wait forever.
+	void drain() {
+		std::uint64_t target = epoch.load(std::memory_order_relaxed) + 2;
+		while (epoch.load(std::memory_order_relaxed) < target) {
+			if (!try_advance())
+				std::this_thread::yield();
+		}
+		collect(local());
+	}
+
+	std::uint64_t current_epoch() const {
+		return epoch.load(std::memory_order_relaxed);
+	}
+};
+
+// Marks a critical region in an epoch_domain for as long as it's in scope:
+// nothing retired meanwhile is freed until it's gone. Guards nest.
+class epoch_guard {
+private:
+	epoch_domain& domain;
+	epoch_domain::participant* p;
+
+	epoch_guard(const epoch_guard&) = delete;
+	epoch_guard& operator=(const epoch_guard&) = delete;
+
+public:
+	explicit epoch_guard(epoch_domain& d = epoch_domain::global())
+		: domain(d), p(d.local()) {
+		domain.enter(p);
+	}
+
+	~epoch_guard() {
+		domain.exit(p);
+	}
+};
+
+}
+#endif
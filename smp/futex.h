@@ -0,0 +1,64 @@
+//============================================================================
+//                                  libcpp-util
+//                   A simple odds-n-ends library for C++11
+//
+//         Licensed under modified BSD license. See LICENSE for details.
+//============================================================================
+
+#ifndef LIBCPP_UTIL_FUTEX_H
+#define LIBCPP_UTIL_FUTEX_H
+
+#include <atomic>
+#include <climits>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace cpputil {
+
+// Thin wrappers around the Linux futex syscall. They operate on a
+// std::atomic<int> so callers keep using ordinary atomics on the word. Waits
+// are private to the process unless shared is set, in which case the word has
+// to live in memory mapped by every process involved.
+//
+// Elsewhere futex_wait() just yields and futex_wake() does nothing, so
+// anything built on them degrades into a yield loop instead of breaking.
+static_assert(sizeof(std::atomic<int>) == sizeof(int),
+	      "futex word must have the layout of an int");
+
+// Sleep as long as word still holds expected. This can return spuriously, so
+// callers always recheck their condition.
+inline void futex_wait(std::atomic<int>& word, int expected,
+		       bool shared = false) {
+#ifdef __linux__
+	syscall(SYS_futex, reinterpret_cast<int*>(&word),
+		shared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE, expected, nullptr,
+		nullptr, 0);
+#else
+	(void)word;
+	(void)expected;
+	(void)shared;
+	std::this_thread::yield();
+#endif
+}
+
+// Wake up to n threads sleeping on word.
+inline void futex_wake(std::atomic<int>& word, int n = INT_MAX,
+		       bool shared = false) {
+#ifdef __linux__
+	syscall(SYS_futex, reinterpret_cast<int*>(&word),
+		shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE, n, nullptr, nullptr,
+		0);
+#else
+	(void)word;
+	(void)n;
+	(void)shared;
+#endif
+}
+
+}
+#endif
@@ -0,0 +1,499 @@
+#include "adaptive_mutex.h"
+#include "barrier.h"
+#include "epoch.h"
+#include "mcs_lock.h"
+#include "profiled_lock.h"
+#include "rw_spinlock.h"
+#include "semaphore.h"
+#include "seqlock.h"
+#include "spinlock.h"
+#include "thread_pool.h"
+#include "ticket_lock.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Increments that aren't atomic only add up if the lock excludes.
+template <typename Lock>
+void mutual_exclusion(unsigned threads, unsigned count) {
+	Lock lock;
+	unsigned long total = 0;
+	std::vector<std::thread> workers;
+	for (unsigned t = 0; t < threads; ++t) {
+		workers.emplace_back([&] {
+			for (unsigned i = 0; i < count; ++i) {
+				std::unique_lock<Lock> l(lock);
+				total = total + 1;
+			}
+		});
+	}
+	for (auto& w : workers)
+		w.join();
+	if (total != (unsigned long)threads * count) {
+		puts("Lost updates");
+		abort();
+	}
+}
+
+template <typename Lock>
+void timed() {
+	Lock lock;
+	if (!lock.try_lock()) {
+		puts("try_lock failed on a free lock");
+		abort();
+	}
+	std::thread other([&] {
+		if (lock.try_lock() ||
+		    lock.try_lock_for(std::chrono::milliseconds(1))) {
+			puts("Locked twice");
+			abort();
+		}
+	});
+	other.join();
+	lock.unlock();
+	if (!lock.try_lock_for(std::chrono::milliseconds(1))) {
+		puts("try_lock_for failed on a free lock");
+		abort();
+	}
+	lock.unlock();
+}
+
+// Readers share the lock with each other but never with a writer, so they
+// never see the two halves of the pair out of step.
+void shared_readers(unsigned readers, unsigned count) {
+	cpputil::rw_spinlock lock;
+	unsigned long a = 0, b = 0;
+	std::atomic_bool done(false);
+	std::vector<std::thread> workers;
+	for (unsigned t = 0; t < readers; ++t) {
+		workers.emplace_back([&] {
+			while (!done.load(std::memory_order_relaxed)) {
+				lock.lock_shared();
+				if (a != b) {
+					puts("Read during a write");
+					abort();
+				}
+				lock.unlock_shared();
+			}
+		});
+	}
+	for (unsigned i = 0; i < count; ++i) {
+		std::unique_lock<cpputil::rw_spinlock> l(lock);
+		a = a + 1;
+		b = b + 1;
+	}
+	done = true;
+	for (auto& w : workers)
+		w.join();
+	if (!lock.try_lock_shared() ||
+	    !lock.try_lock_shared_for(std::chrono::milliseconds(1))) {
+		puts("try_lock_shared failed on a free lock");
+		abort();
+	}
+	if (lock.try_lock()) {
+		puts("Write locked while read locked");
+		abort();
+	}
+	lock.unlock_shared();
+	lock.unlock_shared();
+}
+
+struct triple {
+	unsigned long a, b, c;
+};
+
+// Every value the readers see is one the writer stored whole, and they see
+// them in order.
+void seqlock_readers(unsigned readers, unsigned count) {
+	cpputil::seqlock<triple> value(triple{0, 0, 0});
+	std::vector<std::thread> workers;
+	for (unsigned t = 0; t < readers; ++t) {
+		workers.emplace_back([&] {
+			unsigned long last = 0;
+			while (last != count) {
+				triple v = value.load();
+				if (v.a != v.b || v.b != v.c) {
+					puts("Torn read");
+					abort();
+				}
+				if (v.a < last) {
+					puts("Went back in time");
+					abort();
+				}
+				last = v.a;
+			}
+		});
+	}
+	for (unsigned i = 1; i <= count; ++i) {
+		if (i % 2)
+			value.store(triple{i, i, i});
+		else
+			value.update([](triple& v) { ++v.a, ++v.b, ++v.c; });
+	}
+	for (auto& w : workers)
+		w.join();
+	if (value.version() != count) {
+		puts("Lost a write");
+		abort();
+	}
+}
+
+// Constructing from another seqlock is a copy, which is deleted, rather than
+// a T made from it.
+static_assert(!std::is_constructible<cpputil::seqlock<triple>,
+				     cpputil::seqlock<triple>&>::value,
+	      "seqlock copies from a non-const lvalue");
+
+// futex_semaphore is opt-in; existing users keep the semaphore they had.
+static_assert(std::is_same<cpputil::semaphore,
+			   cpputil::basic_semaphore<>>::value,
+	      "semaphore is still the lock-based one");
+
+// Every post lets exactly one wait through.
+template <typename Semaphore>
+void semaphore_handoff(unsigned count) {
+	Semaphore items(0);
+	std::thread producer([&] {
+		for (unsigned i = 0; i < count; ++i)
+			items.post();
+	});
+	for (unsigned i = 0; i < count; ++i)
+		items.wait();
+	producer.join();
+	if (items.try_wait()) {
+		puts("Extra permit");
+		abort();
+	}
+}
+
+// Permits posted three at a time, taken two at a time by one thread and
+// one at a time by another, all add up.
+void semaphore_batches(unsigned count) {
+	cpputil::futex_semaphore items(0);
+	std::thread pairs([&] {
+		for (unsigned i = 0; i < count; ++i)
+			items.wait(2);
+	});
+	std::thread singles([&] {
+		for (unsigned i = 0; i < 4 * count; ++i)
+			items.wait();
+	});
+	for (unsigned i = 0; i < 2 * count; ++i)
+		items.post(3);
+	pairs.join();
+	singles.join();
+	if (items.value() != 0 || items.try_wait()) {
+		puts("Extra permit");
+		abort();
+	}
+	items.post(2);
+	if (items.try_wait(3) || !items.try_wait(2)) {
+		puts("Batch taken in part");
+		abort();
+	}
+}
+
+// One post_all() lets every sleeping waiter through, however many permits each
+// is after, and leaves nothing over. The waiters get a moment to fall asleep
+// first, since post_all() only covers those waiting already.
+void semaphore_post_all(unsigned waiters) {
+	cpputil::futex_semaphore items(0);
+	items.post_all();
+	if (items.try_wait()) {
+		puts("Permit with nobody waiting");
+		abort();
+	}
+
+	std::atomic_uint arrived(0), done(0);
+	std::vector<std::thread> threads;
+	for (unsigned t = 0; t < waiters; ++t) {
+		threads.emplace_back([&, t] {
+			++arrived;
+			items.wait(t + 1);
+			++done;
+		});
+	}
+	while (arrived != waiters)
+		std::this_thread::yield();
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	items.post_all();
+	auto deadline =
+		std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (done != waiters) {
+		if (std::chrono::steady_clock::now() > deadline) {
+			puts("post_all left waiters asleep");
+			abort();
+		}
+		std::this_thread::yield();
+	}
+	for (auto& t : threads)
+		t.join();
+	if (items.value() != 0) {
+		puts("Extra permit");
+		abort();
+	}
+}
+
+// Only the lock everyone fights over shows up as contended, and the registry
+// puts it first.
+void profiled(unsigned threads, unsigned count) {
+	using lock_type = cpputil::profiled_lock<cpputil::spinlock>;
+	lock_type quiet("quiet");
+	{
+		lock_type hot("hot");
+		std::vector<std::thread> workers;
+		for (unsigned t = 0; t < threads; ++t) {
+			workers.emplace_back([&] {
+				for (unsigned i = 0; i < count; ++i) {
+					std::lock_guard<lock_type> l(hot);
+					// Long enough to be preempted holding it.
+					for (int j = 0; j < 100; ++j)
+						cpputil::cpu_relax();
+				}
+			});
+		}
+		for (unsigned i = 0; i < count; ++i) {
+			std::lock_guard<lock_type> l(quiet);
+		}
+		for (auto& w : workers)
+			w.join();
+
+		cpputil::lock_stats s = hot.profile().stats();
+		if (s.acquisitions != threads * count || !s.contended ||
+		    !s.hold_ticks) {
+			puts("Bad hot lock counts");
+			abort();
+		}
+		s = quiet.profile().stats();
+		if (s.acquisitions != count || s.contended) {
+			puts("Bad quiet lock counts");
+			abort();
+		}
+		auto top = cpputil::lock_registry::instance().top_contended(1);
+		if (top.size() != 1 || top[0].name != "hot") {
+			puts("Wrong lock on top");
+			abort();
+		}
+		FILE* out = tmpfile();
+		cpputil::lock_registry::instance().dump(out, 2);
+		fclose(out);
+	}
+	auto top = cpputil::lock_registry::instance().top_contended(10);
+	if (top.size() != 1 || top[0].name != "quiet") {
+		puts("Destroyed lock still registered");
+		abort();
+	}
+}
+
+// Nobody starts a round before everyone has finished the one before: each
+// thread fills in its slot for the round, and after the barrier every slot
+// must have been filled in.
+template <class Barrier>
+void barrier_rounds(unsigned threads, unsigned rounds, unsigned fanin) {
+	Barrier barrier(threads, fanin);
+	std::vector<unsigned> slots[2];
+	slots[0].resize(threads);
+	slots[1].resize(threads);
+	std::atomic<unsigned> serial(0);
+	std::vector<std::thread> workers;
+	for (unsigned t = 0; t < threads; ++t) {
+		workers.emplace_back([&, t] {
+			for (unsigned r = 1; r <= rounds; ++r) {
+				std::vector<unsigned>& mine = slots[r % 2];
+				mine[t] = r;
+				if (barrier.arrive_and_wait(t))
+					++serial;
+				for (unsigned u = 0; u < threads; ++u) {
+					if (mine[u] != r) {
+						puts("Left the barrier early");
+						abort();
+					}
+				}
+			}
+		});
+	}
+	for (auto& w : workers)
+		w.join();
+	if (serial != rounds) {
+		puts("Wrong number of serial threads");
+		abort();
+	}
+}
+
+void latch(unsigned threads) {
+	cpputil::countdown_latch<> ready(threads, 3);
+	std::atomic<unsigned> arrived(0);
+	std::vector<std::thread> workers;
+	for (unsigned t = 0; t < threads; ++t) {
+		workers.emplace_back([&, t] {
+			++arrived;
+			if (t % 2)
+				ready.count_down(t);
+			else
+				ready.arrive_and_wait(t);
+		});
+	}
+	ready.wait();
+	if (arrived != threads || !ready.try_wait()) {
+		puts("Latch opened early");
+		abort();
+	}
+	for (auto& w : workers)
+		w.join();
+	cpputil::countdown_latch<> empty(0);
+	empty.wait();
+}
+
+struct tracked {
+	static std::atomic<unsigned long> live;
+	unsigned long value;
+	unsigned long check;
+
+	explicit tracked(unsigned long v) : value(v), check(~v) {
+		++live;
+	}
+	~tracked() {
+		check = value;
+		--live;
+	}
+};
+
+std::atomic<unsigned long> tracked::live(0);
+
+// Readers follow a pointer the writer keeps replacing and retiring, and must
+// never see a node after it has been deleted; once everyone is done, every
+// node but the current one has been.
+void epoch_reclaim(unsigned readers, unsigned count) {
+	{
+		cpputil::epoch_domain domain;
+		std::atomic<tracked*> current(new tracked(0));
+		std::atomic_bool done(false);
+		std::vector<std::thread> workers;
+		for (unsigned t = 0; t < readers; ++t) {
+			workers.emplace_back([&] {
+				while (!done.load(std::memory_order_relaxed)) {
+					cpputil::epoch_guard g(domain);
+					cpputil::epoch_guard nested(domain);
+					tracked* n = current.load(
+						std::memory_order_acquire);
+					std::this_thread::yield();
+					if (n->check != ~n->value) {
+						puts("Read a freed node");
+						abort();
+					}
+				}
+			});
+		}
+		for (unsigned i = 1; i <= count; ++i) {
+			tracked* old = current.exchange(
+				new tracked(i), std::memory_order_acq_rel);
+			domain.retire(old);
+		}
+		done = true;
+		for (auto& w : workers)
+			w.join();
+		domain.drain();
+		if (tracked::live != 1) {
+			puts("Retired nodes not freed");
+			abort();
+		}
+		// What a thread retired before exiting is drained along
+		// with our own.
+		std::thread([&] { domain.retire(new tracked(0)); }).join();
+		domain.drain();
+		if (tracked::live != 1) {
+			puts("Orphaned nodes not freed");
+			abort();
+		}
+		domain.retire(current.load());
+	}
+	if (tracked::live != 0) {
+		puts("Domain leaked nodes");
+		abort();
+	}
+}
+
+// Recursive fork-join: every task spawns its left half into the pool and
+// does the right half itself, then waits for the left with get(), which runs
+// other tasks meanwhile rather than blocking the worker.
+void fork_join(unsigned threads) {
+	cpputil::thread_pool pool(threads);
+	std::function<unsigned long(unsigned)> fib = [&](unsigned n) {
+		if (n < 2)
+			return (unsigned long)n;
+		auto left = pool.submit([&, n] { return fib(n - 1); });
+		unsigned long right = fib(n - 2);
+		return pool.get(left) + right;
+	};
+	auto root = pool.submit([&] { return fib(20); });
+	if (pool.get(root) != 6765) {
+		puts("Wrong result");
+		abort();
+	}
+
+	std::vector<std::future<unsigned>> squares;
+	for (unsigned i = 0; i < 1000; ++i)
+		squares.push_back(pool.submit([i] { return i * i; }));
+	for (unsigned i = 0; i < 1000; ++i) {
+		if (pool.get(squares[i]) != i * i) {
+			puts("Wrong result");
+			abort();
+		}
+	}
+}
+
+int main() {
+	puts("Spinlock");
+	mutual_exclusion<cpputil::spinlock>(4, 10000);
+	timed<cpputil::spinlock>();
+	puts("Ticket lock");
+	mutual_exclusion<cpputil::ticket_lock>(4, 10000);
+	timed<cpputil::ticket_lock>();
+	puts("MCS lock");
+	mutual_exclusion<cpputil::mcs_lock>(4, 10000);
+	timed<cpputil::mcs_lock>();
+	puts("Adaptive mutex");
+	mutual_exclusion<cpputil::adaptive_mutex>(4, 10000);
+	timed<cpputil::adaptive_mutex>();
+	puts("Reader-writer spinlock");
+	mutual_exclusion<cpputil::rw_spinlock>(4, 10000);
+	timed<cpputil::rw_spinlock>();
+	shared_readers(3, 10000);
+	puts("Seqlock");
+	mutual_exclusion<cpputil::seqlock<int>>(4, 10000);
+	timed<cpputil::seqlock<int>>();
+	seqlock_readers(3, 100000);
+	puts("Profiled lock");
+	mutual_exclusion<cpputil::profiled_lock<cpputil::spinlock>>(4, 10000);
+	mutual_exclusion<cpputil::profiled_lock<std::mutex>>(4, 10000);
+	timed<cpputil::profiled_lock<cpputil::spinlock>>();
+	profiled(4, 10000);
+	puts("Barrier");
+	barrier_rounds<cpputil::spin_barrier<>>(1, 100, 4);
+	barrier_rounds<cpputil::spin_barrier<>>(5, 2000, 2);
+	barrier_rounds<cpputil::spin_barrier<>>(10, 2000, 4);
+	barrier_rounds<cpputil::spin_barrier<
+		cpputil::yield_wait_policy<>>>(6, 2000, 3);
+	latch(11);
+	puts("Epoch reclamation");
+	epoch_reclaim(3, 100000);
+	puts("Thread pool");
+	fork_join(1);
+	fork_join(4);
+	puts("Semaphore");
+	semaphore_handoff<cpputil::semaphore>(100000);
+	semaphore_handoff<cpputil::futex_semaphore>(100000);
+	semaphore_handoff<cpputil::basic_semaphore<cpputil::ticket_lock>>(
+		100000);
+	semaphore_handoff<cpputil::basic_semaphore<cpputil::mcs_lock>>(
+		100000);
+	semaphore_batches(100000);
+	semaphore_post_all(4);
+	return 0;
+}
@@ -0,0 +1,157 @@
+//============================================================================
+//                                  libcpp-util
+//                   A simple odds-n-ends library for C++11
+//
+//         Licensed under modified BSD license. See LICENSE for details.
+//============================================================================
+
+#ifndef LIBCPP_UTIL_MCS_LOCK_H
+#define LIBCPP_UTIL_MCS_LOCK_H
+
+#include "libcpp-util/smp/spinlock.h"
+
+#include <atomic>
+#include <chrono>
+
+namespace cpputil {
+
+// Mellor-Crummey and Scott queue lock. Waiters line up in a linked list of
+// nodes, and each one spins on a flag in its own node until its predecessor
+// hands the lock over by clearing it, so a handoff touches one waiter's
+// cacheline rather than everyone's, and the lock is granted in FIFO order.
+//
+// The usual interface passes a node to lock() and unlock(); here each thread
+// keeps a small stack of nodes of its own, so the lock is BasicLockable like
+// any other. The holder's node is remembered in the lock until unlock(), which
+// must therefore come from the thread that locked.
+//
+// As with ticket_lock, a waiter that has spun for a while starts yielding, in
+// case the thread ahead of it isn't running.
+class mcs_lock {
+private:
+	// A cacheline each, so waiters spinning on their own nodes don't
+	// disturb each other.
+	struct alignas(cacheline_size) node : cacheline_aligned_new {
+		std::atomic<node*> next;
+		std::atomic_bool locked;
+		node* free_next;
+	};
+	static_assert(sizeof(node) == cacheline_size,
+		      "mcs_lock nodes should be a cacheline each");
+
+	// Nodes not in use by the calling thread, freed when it exits.
+	struct node_cache {
+		node* free = nullptr;
+
+		~node_cache() {
+			while (free) {
+				node* n = free;
+				free = n->free_next;
+				delete n;
+			}
+		}
+	};
+
+	static node_cache& cache() {
+		static thread_local node_cache c;
+		return c;
+	}
+
+	static node* get_node() {
+		node_cache& c = cache();
+		node* n = c.free;
+		if (n)
+			c.free = n->free_next;
+		else
+			n = new node;
+		n->next.store(nullptr, std::memory_order_relaxed);
+		n->locked.store(true, std::memory_order_relaxed);
+		return n;
+	}
+
+	static void put_node(node* n) {
+		node_cache& c = cache();
+		n->free_next = c.free;
+		c.free = n;
+	}
+
+	std::atomic<node*> tail;
+	// Only touched by the holder.
+	node* holder;
+
+	mcs_lock(const mcs_lock&) = delete;
+	mcs_lock& operator=(const mcs_lock&) = delete;
+
+public:
+	mcs_lock() : tail(nullptr), holder(nullptr) {}
+	~mcs_lock() = default;
+
+	void lock() {
+		node* n = get_node();
+		node* prev = tail.exchange(n, std::memory_order_acq_rel);
+		if (prev) {
+			prev->next.store(n, std::memory_order_release);
+			spin_backoff backoff;
+			while (n->locked.load(std::memory_order_acquire))
+				backoff.pause();
+		}
+		holder = n;
+	}
+
+	// Only succeeds when the lock is free and nobody is waiting.
+	bool try_lock() {
+		node* n = get_node();
+		node* expected = nullptr;
+		if (!tail.compare_exchange_strong(expected, n,
+						  std::memory_order_acquire,
+						  std::memory_order_relaxed)) {
+			put_node(n);
+			return false;
+		}
+		holder = n;
+		return true;
+	}
+
+	template <class Rep, class Period>
+	bool try_lock_for(const std::chrono::duration<Rep,Period>& duration) {
+		return try_lock_until(
+				std::chrono::steady_clock::now() + duration);
+	}
+
+	// A queued node can't leave the line, so timed waiters keep trying for
+	// an empty one instead, and aren't served in order.
+	template <class Clock, class Duration>
+	bool try_lock_until(
+			const std::chrono::time_point<Clock, Duration>& when) {
+		while (when > Clock::now()) {
+			if (try_lock())
+				return true;
+			cpu_relax();
+		}
+		return false; // Time elapsed
+	}
+
+	void unlock() {
+		node* n = holder;
+		node* next = n->next.load(std::memory_order_acquire);
+		if (!next) {
+			node* expected = n;
+			if (tail.compare_exchange_strong(
+				    expected, nullptr, std::memory_order_release,
+				    std::memory_order_relaxed)) {
+				put_node(n);
+				return;
+			}
+			// Someone is queueing behind us but hasn't linked
+			// in yet.
+			spin_backoff backoff;
+			while (!(next = n->next.load(std::memory_order_acquire)))
+				backoff.pause();
+		}
+		next->locked.store(false, std::memory_order_release);
+		put_node(n);
+	}
+};
+
+}
+#endif
@@ -0,0 +1,346 @@
+//============================================================================
+//                                  libcpp-util
+//                   A simple odds-n-ends library for C++11
+//
+//         Licensed under modified BSD license. See LICENSE for details.
+//============================================================================
+
+#ifndef LIBCPP_UTIL_PROFILED_LOCK_H
+#define LIBCPP_UTIL_PROFILED_LOCK_H
+
+#include "libcpp-util/smp/spinlock.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if __x86_64__ && __GNUC__
+#include <x86intrin.h>
+#endif
+
+namespace cpputil {
+
+// Cheap timestamp for measuring short intervals: the TSC where there is one,
+// otherwise steady_clock nanoseconds. Only differences mean anything, and only
+// on the same machine.
+inline std::uint64_t read_ticks() {
+#if __x86_64__ && __GNUC__
+	return __rdtsc();
+#else
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Power of two histogram of tick counts: bucket i holds the samples in
+// [2^(i-1), 2^i), and bucket 0 the zeros.
+class tick_histogram {
+public:
+	static constexpr unsigned buckets = 65;
+
+private:
+	std::atomic<std::uint64_t> counts[buckets];
+
+	tick_histogram(const tick_histogram&) = delete;
+	tick_histogram& operator=(const tick_histogram&) = delete;
+
+public:
+	tick_histogram() {
+		for (auto& c : counts)
+			c.store(0, std::memory_order_relaxed);
+	}
+
+	// Bits needed to hold ticks, so zero has a bucket of its own.
+	static unsigned bucket(std::uint64_t ticks) {
+#if __GNUC__
+		return ticks ? 64 - __builtin_clzll(ticks) : 0;
+#else
+		unsigned bits = 0;
+		while (ticks) {
+			ticks >>= 1;
+			++bits;
+		}
+		return bits;
+#endif
+	}
+
+	// Callers serialize records between themselves; readers can look at
+	// any time.
+	void record(std::uint64_t ticks) {
+		auto& c = counts[bucket(ticks)];
+		c.store(c.load(std::memory_order_relaxed) + 1,
+			std::memory_order_relaxed);
+	}
+
+	std::uint64_t count(unsigned i) const {
+		return counts[i].load(std::memory_order_relaxed);
+	}
+
+	// Upper bound of the bucket the given fraction of samples falls in.
+	std::uint64_t percentile(double p) const {
+		std::uint64_t total = 0;
+		for (auto& c : counts)
+			total += c.load(std::memory_order_relaxed);
+		std::uint64_t want = total * p;
+		std::uint64_t seen = 0;
+		for (unsigned i = 0; i < buckets; ++i) {
+			seen += count(i);
+			if (seen > want)
+				return i ? (i < 64 ? std::uint64_t(1) << i :
+						     UINT64_MAX) :
+					   0;
+		}
+		return 0;
+	}
+};
+
+// What a profiled_lock has counted, copied out at one moment.
+struct lock_stats {
+	std::string name;
+	std::uint64_t acquisitions;
+	std::uint64_t contended;
+	std::uint64_t wait_ticks;
+	std::uint64_t hold_ticks;
+	std::uint64_t wait_p99;
+	std::uint64_t hold_p99;
+};
+
+// Counters for one lock, kept on the lock_registry's list for as long as the
+// lock exists. Everything is updated by the holder of the lock, so plain
+// relaxed loads and stores are enough, and readers may look at any time.
+class lock_profile {
+private:
+	friend class lock_registry;
+	template <class Lock> friend class profiled_lock;
+
+	std::string name;
+	std::atomic<std::uint64_t> acquisitions;
+	std::atomic<std::uint64_t> contended;
+	std::atomic<std::uint64_t> wait_ticks;
+	std::atomic<std::uint64_t> hold_ticks;
+	tick_histogram wait_times;
+	tick_histogram hold_times;
+	lock_profile* prev;
+	lock_profile* next;
+
+	lock_profile(const lock_profile&) = delete;
+	lock_profile& operator=(const lock_profile&) = delete;
+
+	static void add(std::atomic<std::uint64_t>& c, std::uint64_t n) {
+		c.store(c.load(std::memory_order_relaxed) + n,
+			std::memory_order_relaxed);
+	}
+
+	void acquired(bool waited, std::uint64_t wait) {
+		add(acquisitions, 1);
+		if (waited) {
+			add(contended, 1);
+			add(wait_ticks, wait);
+			wait_times.record(wait);
+		}
+	}
+
+	void released(std::uint64_t hold) {
+		add(hold_ticks, hold);
+		hold_times.record(hold);
+	}
+
+public:
+	explicit lock_profile(std::string n);
+	~lock_profile();
+
+	lock_stats stats() const {
+		return lock_stats{name,
+				  acquisitions.load(std::memory_order_relaxed),
+				  contended.load(std::memory_order_relaxed),
+				  wait_ticks.load(std::memory_order_relaxed),
+				  hold_ticks.load(std::memory_order_relaxed),
+				  wait_times.percentile(0.99),
+				  hold_times.percentile(0.99)};
+	}
+
+	const tick_histogram& wait_histogram() const {
+		return wait_times;
+	}
+
+	const tick_histogram& hold_histogram() const {
+		return hold_times;
+	}
+};
+
+// Every live lock_profile in the process, so the hot locks can be found at
+// runtime. Never destroyed, so locks with static storage can still take
+// themselves off the list on the way out.
+class lock_registry {
+private:
+	spinlock s;
+	lock_profile* head;
+
+	lock_registry() : head(nullptr) {}
+	lock_registry(const lock_registry&) = delete;
+	lock_registry& operator=(const lock_registry&) = delete;
+
+	friend class lock_profile;
+
+	void add(lock_profile* p) {
+		std::lock_guard<spinlock> lock(s);
+		p->prev = nullptr;
+		p->next = head;
+		if (head)
+			head->prev = p;
+		head = p;
+	}
+
+	void remove(lock_profile* p) {
+		std::lock_guard<spinlock> lock(s);
+		if (p->prev)
+			p->prev->next = p->next;
+		else
+			head = p->next;
+		if (p->next)
+			p->next->prev = p->prev;
+	}
+
+public:
+	static lock_registry& instance() {
+		static lock_registry* r = new lock_registry;
+		return *r;
+	}
+
+	// The n locks that have had to wait most often, worst first.
+	std::vector<lock_stats> top_contended(size_t n) {
+		std::vector<lock_stats> all;
+		{
+			std::lock_guard<spinlock> lock(s);
+			for (lock_profile* p = head; p; p = p->next)
+				all.push_back(p->stats());
+		}
+		auto by_contention = [](const lock_stats& a,
+					const lock_stats& b) {
+			return a.contended > b.contended;
+		};
+		if (n < all.size()) {
+			std::partial_sort(all.begin(), all.begin() + n,
+					  all.end(), by_contention);
+			all.resize(n);
+		} else {
+			std::sort(all.begin(), all.end(), by_contention);
+		}
+		return all;
+	}
+
+	void dump(FILE* out, size_t n = 10) {
+		fprintf(out, "%-24s %12s %12s %12s %12s %12s %12s\n", "lock",
+			"acquired", "contended", "avg wait", "p99 wait",
+			"avg hold", "p99 hold");
+		for (const auto& l : top_contended(n)) {
+			fprintf(out,
+				"%-24s %12llu %12llu %12llu %12llu %12llu "
+				"%12llu\n",
+				l.name.c_str(),
+				(unsigned long long)l.acquisitions,
+				(unsigned long long)l.contended,
+				(unsigned long long)(l.contended ?
+					l.wait_ticks / l.contended : 0),
+				(unsigned long long)l.wait_p99,
+				(unsigned long long)(l.acquisitions ?
+					l.hold_ticks / l.acquisitions : 0),
+				(unsigned long long)l.hold_p99);
+		}
+	}
+};
+
+inline lock_profile::lock_profile(std::string n)
+	: name(std::move(n)), acquisitions(0), contended(0), wait_ticks(0),
+	  hold_ticks(0) {
+	lock_registry::instance().add(this);
+}
+
+inline lock_profile::~lock_profile() {
+	lock_registry::instance().remove(this);
+}
+
+// Wraps any lock with the interface of a spinlock and counts how often it is
+// taken, how often that meant waiting, and how long the waits and the holds
+// were, in read_ticks() units. A lock that could be had straight away counts
+// as uncontended and costs two timestamps on top of the lock itself.
+//
+// The counters are only updated by whoever holds the lock, so Lock has to
+// really exclude; wrapping a noop_lock will count, but not reliably.
+template <class Lock>
+class profiled_lock {
+private:
+	Lock l;
+	lock_profile counters;
+	std::uint64_t hold_start;
+
+	profiled_lock(const profiled_lock&) = delete;
+	profiled_lock& operator=(const profiled_lock&) = delete;
+
+	void acquired(bool waited, std::uint64_t since) {
+		std::uint64_t now = read_ticks();
+		counters.acquired(waited, now - since);
+		hold_start = now;
+	}
+
+public:
+	explicit profiled_lock(std::string name = "unnamed")
+		: counters(std::move(name)), hold_start(0) {}
+	~profiled_lock() = default;
+
+	void lock() {
+		std::uint64_t start = read_ticks();
+		if (l.try_lock()) {
+			acquired(false, start);
+			return;
+		}
+		l.lock();
+		acquired(true, start);
+	}
+
+	bool try_lock() {
+		std::uint64_t start = read_ticks();
+		if (!l.try_lock())
+			return false;
+		acquired(false, start);
+		return true;
+	}
+
+	template <class Rep, class Period>
+	bool try_lock_for(const std::chrono::duration<Rep,Period>& duration) {
+		return try_lock_until(
+				std::chrono::steady_clock::now() + duration);
+	}
+
+	template <class Clock, class Duration>
+	bool try_lock_until(
+			const std::chrono::time_point<Clock, Duration>& when) {
+		std::uint64_t start = read_ticks();
+		if (l.try_lock()) {
+			acquired(false, start);
+			return true;
+		}
+		if (!l.try_lock_until(when))
+			return false; // Time elapsed
+		acquired(true, start);
+		return true;
+	}
+
+	void unlock() {
+		counters.released(read_ticks() - hold_start);
+		l.unlock();
+	}
+
+	const lock_profile& profile() const {
+		return counters;
+	}
+};
+
+}
+#endif
@@ -0,0 +1,146 @@
+//============================================================================
+//                                  libcpp-util
+//                   A simple odds-n-ends library for C++11
+//
+//         Licensed under modified BSD license. See LICENSE for details.
+//============================================================================
+
+#ifndef LIBCPP_UTIL_RW_SPINLOCK_H
+#define LIBCPP_UTIL_RW_SPINLOCK_H
+
+#include "libcpp-util/smp/spinlock.h"
+
+#include <atomic>
+#include <chrono>
+
+namespace cpputil {
+
+// Reader-writer spinlock. Any number of readers can hold it at once, through
+// lock_shared() and friends, or one writer through lock(); it works with
+// std::shared_lock as well as std::unique_lock.
+//
+// Writers take precedence: once one is waiting, new readers hold back until it
+// has been and gone, so a steady stream of readers can't starve it. The
+// flip side is that a steady stream of writers starves the readers, which is
+// the right way round for state that is read all the time and written now and
+// then.
+//
+// Holder, waiting writers and readers all share one word:
+//
+//	bit 0		a writer holds the lock
+//	bits 1-15	writers waiting
+//	bits 16-31	readers holding the lock
+class rw_spinlock {
+private:
+	enum : unsigned {
+		writer = 1,
+		waiting_unit = 1 << 1,
+		waiting_mask = 0xfffe,
+		reader_unit = 1 << 16,
+		reader_mask = 0xffff0000
+	};
+
+	std::atomic<unsigned> state;
+
+	rw_spinlock(const rw_spinlock&) = delete;
+	rw_spinlock& operator=(const rw_spinlock&) = delete;
+
+	// For a writer already counted as waiting.
+	bool try_lock_waiting() {
+		unsigned s = state.load(std::memory_order_relaxed);
+		return !(s & (writer | reader_mask)) &&
+		       state.compare_exchange_weak(s, (s - waiting_unit) | writer,
+						   std::memory_order_acquire,
+						   std::memory_order_relaxed);
+	}
+
+public:
+	rw_spinlock() : state(0) {}
+	~rw_spinlock() = default;
+
+	void lock() {
+		state.fetch_add(waiting_unit, std::memory_order_relaxed);
+		spin_backoff backoff;
+		while (!try_lock_waiting())
+			backoff.pause();
+	}
+
+	bool try_lock() {
+		unsigned s = state.load(std::memory_order_relaxed);
+		while (!(s & (writer | reader_mask))) {
+			if (state.compare_exchange_weak(s, s | writer,
+							std::memory_order_acquire,
+							std::memory_order_relaxed))
+				return true;
+		}
+		return false;
+	}
+
+	template <class Rep, class Period>
+	bool try_lock_for(const std::chrono::duration<Rep,Period>& duration) {
+		return try_lock_until(
+				std::chrono::steady_clock::now() + duration);
+	}
+
+	// Counts as waiting while it tries, so it holds off new readers as
+	// lock() does.
+	template <class Clock, class Duration>
+	bool try_lock_until(
+			const std::chrono::time_point<Clock, Duration>& when) {
+		state.fetch_add(waiting_unit, std::memory_order_relaxed);
+		while (when > Clock::now()) {
+			if (try_lock_waiting())
+				return true;
+			cpu_relax();
+		}
+		state.fetch_sub(waiting_unit, std::memory_order_relaxed);
+		return false; // Time elapsed
+	}
+
+	void unlock() {
+		state.fetch_and(~unsigned(writer), std::memory_order_release);
+	}
+
+	void lock_shared() {
+		spin_backoff backoff;
+		while (!try_lock_shared())
+			backoff.pause();
+	}
+
+	// Fails if a writer holds the lock or is waiting for it.
+	bool try_lock_shared() {
+		unsigned s = state.load(std::memory_order_relaxed);
+		while (!(s & (writer | waiting_mask))) {
+			if (state.compare_exchange_weak(s, s + reader_unit,
+							std::memory_order_acquire,
+							std::memory_order_relaxed))
+				return true;
+		}
+		return false;
+	}
+
+	template <class Rep, class Period>
+	bool try_lock_shared_for(
+			const std::chrono::duration<Rep,Period>& duration) {
+		return try_lock_shared_until(
+				std::chrono::steady_clock::now() + duration);
+	}
+
+	template <class Clock, class Duration>
+	bool try_lock_shared_until(
+			const std::chrono::time_point<Clock, Duration>& when) {
+		while (when > Clock::now()) {
+			if (try_lock_shared())
+				return true;
+			cpu_relax();
+		}
+		return false; // Time elapsed
+	}
+
+	void unlock_shared() {
+		state.fetch_sub(reader_unit, std::memory_order_release);
+	}
+};
+
+}
+#endif
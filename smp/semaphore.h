@@ -8,30 +8,36 @@
 #ifndef LIBCPP_UTIL_SEMAPHORE_H
 #define LIBCPP_UTIL_SEMAPHORE_H
 
+#include "libcpp-util/smp/futex.h"
 #include "libcpp-util/smp/spinlock.h"
 
+#include <atomic>
+#include <climits>
 #include <condition_variable>
 
 namespace cpputil {
 
-class semaphore {
+// Counting semaphore over any BasicLockable, e.g. a ticket_lock or mcs_lock
+// when it has to be fair.
+template <class Lock = cacheline_spinlock>
+class basic_semaphore {
 private:
-	cacheline_spinlock s;
+	Lock s;
 	std::condition_variable_any cv;
 	unsigned count;
 	unsigned waiters;
 
-	semaphore(const semaphore&) = delete;
-	semaphore& operator=(const semaphore&) = delete;
+	basic_semaphore(const basic_semaphore&) = delete;
+	basic_semaphore& operator=(const basic_semaphore&) = delete;
 public:
-	semaphore(unsigned initial_count) 
+	basic_semaphore(unsigned initial_count) 
 		: count(initial_count), waiters(0) {
 	}
 
-	~semaphore() = default;
+	~basic_semaphore() = default;
 
 	void post() {
-		std::unique_lock<cacheline_spinlock> lock(s);
+		std::unique_lock<Lock> lock(s);
 		count++;
 		if (waiters > 0) {
 			waiters--;
@@ -41,14 +47,14 @@ public:
 	}
 
 	void post_all() {
-		std::lock_guard<cacheline_spinlock> lock(s);
+		std::lock_guard<Lock> lock(s);
 		count += waiters;
 		waiters = 0;
 		cv.notify_all();
 	}
 
 	void wait() {
-		std::unique_lock<cacheline_spinlock> lock(s);
+		std::unique_lock<Lock> lock(s);
 		if (count > 0) {
 			count--;
 		} else {
@@ -60,7 +66,7 @@ public:
 	}
 
 	bool try_wait() {
-		std::lock_guard<cacheline_spinlock> lock(s);
+		std::lock_guard<Lock> lock(s);
 		if (count > 0) {
 			count--;
 			return true;
@@ -70,10 +76,124 @@ public:
 	}
 
 	unsigned value() {
-		std::lock_guard<cacheline_spinlock> lock(s);
+		std::lock_guard<Lock> lock(s);
 		return count;
 	}
 };
 
+// Counting semaphore with the count in a single futex word. Taking a permit
+// when there is one is a single CAS and giving one back a single atomic add,
+// and neither goes near the kernel unless somebody is actually asleep. The
+// count is an int, so it holds at most INT_MAX permits.
+//
+// Sleepers are counted in a word of their own, with the same handshake as the
+// wait policies: a waiter counts itself and then checks the count, a poster
+// adds to the count and then checks for waiters, with a full fence in between
+// on both sides so at least one of them sees the other.
+//
+// wait(n) takes n permits at once, all or none, and post(n) gives n back. A
+// thread after several permits may be woken for fewer than it needs and go
+// back to sleep, which would strand the wakeup, so while any are waiting a
+// post wakes everyone instead of just as many as it posted.
+//
+// post_all() tops the count up to the permits the threads waiting right now
+// have asked for between them, so that every one of them can go unless
+// somebody else takes permits first. A thread that only starts waiting after
+// it isn't covered, and one that is just leaving with its permits may still
+// be counted, which leaves some over.
+class futex_semaphore {
+private:
+	std::atomic<int> count;
+	std::atomic<int> waiters;
+	std::atomic<int> batch_waiters;
+	// Permits all of them asked for between them.
+	std::atomic<int> wanted;
+
+	futex_semaphore(const futex_semaphore&) = delete;
+	futex_semaphore& operator=(const futex_semaphore&) = delete;
+
+	void wait_slow(int n) {
+		std::atomic<int>& waiting = n > 1 ? batch_waiters : waiters;
+		waiting.fetch_add(1, std::memory_order_relaxed);
+		wanted.fetch_add(n, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		while (1) {
+			int c = count.load(std::memory_order_relaxed);
+			if (c >= n) {
+				if (count.compare_exchange_weak(
+					    c, c - n, std::memory_order_acquire,
+					    std::memory_order_relaxed))
+					break;
+				continue;
+			}
+			futex_wait(count, c);
+		}
+		wanted.fetch_sub(n, std::memory_order_relaxed);
+		waiting.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	// After adding n permits; pairs with the fence in wait_slow().
+	void wake(unsigned n) {
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (batch_waiters.load(std::memory_order_relaxed))
+			futex_wake(count);
+		else if (waiters.load(std::memory_order_relaxed))
+			futex_wake(count, n < INT_MAX ? n : INT_MAX);
+	}
+
+public:
+	futex_semaphore(unsigned initial_count)
+		: count(initial_count), waiters(0), batch_waiters(0),
+		  wanted(0) {
+	}
+
+	~futex_semaphore() = default;
+
+	void post(unsigned n = 1) {
+		count.fetch_add(n, std::memory_order_release);
+		wake(n);
+	}
+
+	// Enough permits for every thread waiting right now; see above.
+	void post_all() {
+		// Pairs with the fence in wait_slow(): anyone who has counted
+		// themselves in wanted by now is seen.
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int want = wanted.load(std::memory_order_relaxed);
+		int c = count.load(std::memory_order_relaxed);
+		while (c < want) {
+			if (count.compare_exchange_weak(
+				    c, want, std::memory_order_release,
+				    std::memory_order_relaxed)) {
+				wake(want - c);
+				return;
+			}
+		}
+	}
+
+	void wait(unsigned n = 1) {
+		if (!try_wait(n))
+			wait_slow(n);
+	}
+
+	bool try_wait(unsigned n = 1) {
+		int c = count.load(std::memory_order_relaxed);
+		while (c >= int(n)) {
+			if (count.compare_exchange_weak(c, c - n,
+							std::memory_order_acquire,
+							std::memory_order_relaxed))
+				return true;
+		}
+		return false;
+	}
+
+	unsigned value() {
+		return count.load(std::memory_order_relaxed);
+	}
+};
+
+// What semaphore has always been; futex_semaphore is there to opt into.
+using semaphore = basic_semaphore<>;
+
 }
 #endif
@@ -0,0 +1,164 @@
+//============================================================================
+//                                  libcpp-util
+//                   A simple odds-n-ends library for C++11
+//
+//         Licensed under modified BSD license. See LICENSE for details.
+//============================================================================
+
+#ifndef LIBCPP_UTIL_SEQLOCK_H
+#define LIBCPP_UTIL_SEQLOCK_H
+
+#include "libcpp-util/smp/atomic_words.h"
+#include "libcpp-util/smp/spinlock.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+
+namespace cpputil {
+
+// A value of type T guarded by a sequence lock, for state that is read far
+// more often than it is written. Readers never write to shared memory, so
+// they don't bounce the cacheline between each other the way even a
+// reader-writer lock does: they note the sequence number, copy the value out,
+// and try again if a writer was in the middle of it or has been since.
+//
+// Writers exclude each other with a Lock, and the seqlock itself is the
+// writer side's lock, with the timed interface of a spinlock: between lock()
+// and unlock() the holder may write() new contents, and the sequence number
+// is odd so readers know to wait. store() and update() wrap the whole thing.
+//
+// The value is stored as atomic_words, so T has to be trivially copyable. A
+// reader can see a torn copy before it notices and retries, but it never
+// returns one.
+template <typename T, class Lock = spinlock>
+class seqlock {
+	static_assert(std::is_trivially_copyable<T>::value,
+		      "seqlock values must be trivially copyable");
+
+private:
+	Lock writer;
+	std::atomic<unsigned> sequence;
+	atomic_words<T> data;
+
+	seqlock(const seqlock&) = delete;
+	seqlock& operator=(const seqlock&) = delete;
+
+	// Whether a constructor argument list is just another seqlock, which
+	// the forwarding constructor mustn't take for a T.
+	template <class... Args>
+	struct is_seqlock : std::false_type {};
+	template <class Arg>
+	struct is_seqlock<Arg>
+		: std::is_same<typename std::decay<Arg>::type, seqlock> {};
+
+	void begin_write() {
+		sequence.store(sequence.load(std::memory_order_relaxed) + 1,
+			       std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+public:
+	using value_type = T;
+
+	template <class... Args, class = typename std::enable_if<
+					 !is_seqlock<Args...>::value>::type>
+	explicit seqlock(Args&&... args) : sequence(0) {
+		data.store(T(std::forward<Args>(args)...));
+	}
+	~seqlock() = default;
+
+	// Reader side.
+
+	// A single attempt: false if a writer got in the way.
+	bool try_load(T& out) const {
+		unsigned seq = sequence.load(std::memory_order_acquire);
+		if (seq & 1)
+			return false;
+		T val = data.load();
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (sequence.load(std::memory_order_relaxed) != seq)
+			return false;
+		out = val;
+		return true;
+	}
+
+	T load() const {
+		// Somewhere to put it, since T needn't be default
+		// constructible; try_load() overwrites it.
+		T val = data.load();
+		spin_backoff backoff;
+		while (!try_load(val))
+			backoff.pause();
+		return val;
+	}
+
+	// Number of completed writes so far.
+	unsigned version() const {
+		return sequence.load(std::memory_order_acquire) / 2;
+	}
+
+	// Writer side.
+
+	void lock() {
+		writer.lock();
+		begin_write();
+	}
+
+	bool try_lock() {
+		if (!writer.try_lock())
+			return false;
+		begin_write();
+		return true;
+	}
+
+	template <class Rep, class Period>
+	bool try_lock_for(const std::chrono::duration<Rep,Period>& duration) {
+		return try_lock_until(
+				std::chrono::steady_clock::now() + duration);
+	}
+
+	template <class Clock, class Duration>
+	bool try_lock_until(
+			const std::chrono::time_point<Clock, Duration>& when) {
+		while (when > Clock::now())
+			if (try_lock())
+				return true;
+		return false; // Time elapsed
+	}
+
+	void unlock() {
+		sequence.store(sequence.load(std::memory_order_relaxed) + 1,
+			       std::memory_order_release);
+		writer.unlock();
+	}
+
+	// Only with the lock held.
+	void write(const T& val) {
+		data.store(val);
+	}
+
+	// Only with the lock held; nobody else can change it meanwhile.
+	T read() const {
+		return data.load();
+	}
+
+	void store(const T& val) {
+		std::lock_guard<seqlock> l(*this);
+		write(val);
+	}
+
+	// Calls f on a copy of the value, and publishes the result.
+	template <class F>
+	void update(F f) {
+		std::lock_guard<seqlock> l(*this);
+		T val = read();
+		f(val);
+		write(val);
+	}
+};
+
+}
+#endif
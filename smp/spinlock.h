@@ -10,15 +10,46 @@
 
 #include <atomic>
 #include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <thread>
 
+namespace cpputil {
+
+// Tell the CPU we're spinning so it can back off the pipeline (and give the
+// sibling hyperthread a chance). Anything that spin-waits should call this.
 // TODO: This is usable on IA32 compatible
+inline void cpu_relax() {
 #if __x86_64__ && __GNUC__
-#define cpu_relax() asm volatile("pause\n": : :"memory")
-#else
-#define cpu_relax()
+	asm volatile("pause\n": : :"memory");
 #endif
+}
 
-namespace cpputil {
+// Spin-then-yield for waiters that can't make progress until some other
+// thread does. Spinning is cheapest while that thread is running, but if it
+// isn't, it can't get anywhere until we give up the core, so after a while
+// spinning each pause() yields instead. One per wait.
+class spin_backoff {
+private:
+	enum : unsigned { spins_before_yield = 1000 };
+
+	unsigned spins;
+
+public:
+	spin_backoff() : spins(0) {}
+
+	// n relaxes at a time, for waiters that know roughly how long the
+	// wait is.
+	void pause(unsigned n = 1) {
+		if (spins > spins_before_yield) {
+			std::this_thread::yield();
+			return;
+		}
+		for (; n; --n, ++spins)
+			cpu_relax();
+	}
+};
 
 class spinlock {
 	std::atomic_flag flag;
@@ -90,9 +121,43 @@ public:
 	}
 };
 
-using cacheline_spinlock = padded_spinlock<64>;
+// Destructive interference size for the platforms we care about.
+constexpr unsigned cacheline_size = 64;
+
+// Base for cacheline-aligned types that live on the heap. Plain new only
+// promises alignof(std::max_align_t) before C++17, so these come from
+// posix_memalign instead.
+struct cacheline_aligned_new {
+	static void* operator new(std::size_t size) {
+		void* p;
+#ifdef _WIN32
+		p = _aligned_malloc(size, cacheline_size);
+		if (!p)
+#else
+		if (posix_memalign(&p, cacheline_size, size))
+#endif
+			throw std::bad_alloc();
+		return p;
+	}
+
+	static void* operator new[](std::size_t size) {
+		return operator new(size);
+	}
+
+	static void operator delete(void* p) noexcept {
+#ifdef _WIN32
+		_aligned_free(p);
+#else
+		free(p);
+#endif
+	}
+
+	static void operator delete[](void* p) noexcept {
+		operator delete(p);
+	}
+};
+
+using cacheline_spinlock = padded_spinlock<cacheline_size>;
 
 }
-
-#undef cpu_relax // Don't pollute
 #endif
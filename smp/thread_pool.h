@@ -0,0 +1,198 @@
+//============================================================================
+//                                  libcpp-util
+//                   A simple odds-n-ends library for C++11
+//
+//         Licensed under modified BSD license. See LICENSE for details.
+//============================================================================
+
+#ifndef LIBCPP_UTIL_THREAD_POOL_H
+#define LIBCPP_UTIL_THREAD_POOL_H
+
+#include "libcpp-util/fifo/segmented_queue.h"
+#include "libcpp-util/fifo/work_stealing_deque.h"
+#include "libcpp-util/smp/spinlock.h"
+#include "libcpp-util/smp/wait_policy.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace cpputil {
+
+// Work-stealing thread pool. Every worker owns a work_stealing_deque: tasks
+// submitted from inside a task go on the submitting worker's own deque, and
+// are run most-recent-first by it, which keeps fork-join work cache-hot.
+// Tasks submitted from anywhere else go through a shared inbox. A worker that
+// runs dry checks the inbox and then tries to steal the oldest task from the
+// other workers, starting at a random one, before parking.
+//
+// submit() hands back a std::future. A task that needs the result of a task it
+// spawned should wait for it with get(), which keeps running other tasks in
+// the meantime instead of tying up the worker.
+template <class WaitPolicy = futex_wait_policy<>>
+class basic_thread_pool {
+private:
+	struct task {
+		virtual ~task() = default;
+		virtual void run() = 0;
+	};
+
+	template <typename R>
+	struct packaged : task {
+		std::packaged_task<R()> fn;
+
+		template <class F>
+		explicit packaged(F&& f) : fn(std::forward<F>(f)) {}
+
+		void run() override {
+			fn();
+		}
+	};
+
+	struct worker : cacheline_aligned_new {
+		basic_thread_pool* pool;
+		work_stealing_deque<task*> deque;
+		std::uint32_t seed;
+		std::thread thread;
+
+		worker(basic_thread_pool* p, std::uint32_t s)
+			: pool(p), seed(s) {}
+
+		// xorshift32; only needs to spread thieves out.
+		std::uint32_t random() {
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+			return seed;
+		}
+	};
+
+	std::vector<std::unique_ptr<worker>> workers;
+	segmented_queue<task*> inbox;
+	std::atomic_bool stopping;
+	WaitPolicy idle;
+
+	basic_thread_pool(const basic_thread_pool&) = delete;
+	basic_thread_pool& operator=(const basic_thread_pool&) = delete;
+
+	static worker*& current_worker() {
+		static thread_local worker* w = nullptr;
+		return w;
+	}
+
+	worker* local_worker() {
+		worker* w = current_worker();
+		return w && w->pool == this ? w : nullptr;
+	}
+
+	void schedule(task* t) {
+		if (worker* w = local_worker())
+			w->deque.push(t);
+		else
+			inbox.push(t);
+		idle.notify_one();
+	}
+
+	task* find_task(worker* self) {
+		task* t;
+		if (self && self->deque.take(t))
+			return t;
+		if (inbox.try_pop(t))
+			return t;
+		std::size_t n = workers.size();
+		std::size_t start = self ? self->random() % n : 0;
+		for (std::size_t i = 0; i < n; ++i) {
+			worker* victim = workers[(start + i) % n].get();
+			if (victim != self && victim->deque.steal(t))
+				return t;
+		}
+		return nullptr;
+	}
+
+	static void run_task(task* t) {
+		t->run();
+		delete t;
+	}
+
+	void work(worker* self) {
+		current_worker() = self;
+		while (1) {
+			task* t = find_task(self);
+			if (!t) {
+				idle.wait([&] {
+					return (t = find_task(self)) || stopping;
+				});
+				// Only stop once there's nothing left to run.
+				if (!t)
+					break;
+			}
+			run_task(t);
+		}
+		current_worker() = nullptr;
+	}
+
+public:
+	explicit basic_thread_pool(
+		unsigned threads = std::thread::hardware_concurrency())
+		: stopping(false) {
+		if (!threads)
+			threads = 1;
+		for (unsigned i = 0; i < threads; ++i)
+			workers.emplace_back(new worker(this, 2463534242u + i));
+		for (auto& w : workers)
+			w->thread = std::thread(&basic_thread_pool::work, this,
+						w.get());
+	}
+
+	// Runs everything already submitted, then joins the workers.
+	~basic_thread_pool() {
+		stopping = true;
+		idle.notify_all();
+		for (auto& w : workers)
+			w->thread.join();
+	}
+
+	std::size_t size() const {
+		return workers.size();
+	}
+
+	template <class F>
+	auto submit(F&& f) -> std::future<decltype(f())> {
+		using R = decltype(f());
+		auto t = new packaged<R>(std::forward<F>(f));
+		auto fut = t->fn.get_future();
+		schedule(t);
+		return fut;
+	}
+
+	// Run one pending task on the calling thread, if there is one.
+	bool run_pending_task() {
+		task* t = find_task(local_worker());
+		if (!t)
+			return false;
+		run_task(t);
+		return true;
+	}
+
+	// Wait for fut, running other tasks while it isn't ready.
+	template <typename R>
+	R get(std::future<R>& fut) {
+		while (fut.wait_for(std::chrono::seconds(0)) !=
+		       std::future_status::ready) {
+			if (!run_pending_task())
+				std::this_thread::yield();
+		}
+		return fut.get();
+	}
+};
+
+using thread_pool = basic_thread_pool<>;
+
+}
+#endif
@@ -0,0 +1,87 @@
+//============================================================================
+//                                  libcpp-util
+//                   A simple odds-n-ends library for C++11
+//
+//         Licensed under modified BSD license. See LICENSE for details.
+//============================================================================
+
+#ifndef LIBCPP_UTIL_TICKET_LOCK_H
+#define LIBCPP_UTIL_TICKET_LOCK_H
+
+#include "libcpp-util/smp/spinlock.h"
+
+#include <atomic>
+#include <chrono>
+
+namespace cpputil {
+
+// Fair spinlock: lock() takes a ticket and waits for it to be served, so the
+// lock is handed out in the order it was asked for. Waiters back off in
+// proportion to how far back in the line they are, which keeps most of them
+// off the now_serving line until their turn is close; an mcs_lock avoids the
+// shared line altogether, at the cost of a queue node per acquisition.
+//
+// A waiter whose holder isn't running can't get anywhere, so after a while
+// spinning it starts yielding the core instead.
+class ticket_lock {
+private:
+	std::atomic<unsigned> next_ticket;
+	std::atomic<unsigned> now_serving;
+
+	ticket_lock(const ticket_lock&) = delete;
+	ticket_lock& operator=(const ticket_lock&) = delete;
+
+public:
+	ticket_lock() : next_ticket(0), now_serving(0) {}
+	~ticket_lock() = default;
+
+	void lock() {
+		unsigned ticket =
+			next_ticket.fetch_add(1, std::memory_order_relaxed);
+		spin_backoff backoff;
+		while (1) {
+			unsigned serving =
+				now_serving.load(std::memory_order_acquire);
+			if (serving == ticket)
+				return;
+			backoff.pause(ticket - serving);
+		}
+	}
+
+	// Only succeeds when nobody holds or is waiting for the lock, so it
+	// never jumps the line.
+	bool try_lock() {
+		unsigned serving = now_serving.load(std::memory_order_relaxed);
+		return next_ticket.compare_exchange_strong(
+			serving, serving + 1, std::memory_order_acquire,
+			std::memory_order_relaxed);
+	}
+
+	template <class Rep, class Period>
+	bool try_lock_for(const std::chrono::duration<Rep,Period>& duration) {
+		return try_lock_until(
+				std::chrono::steady_clock::now() + duration);
+	}
+
+	// A timed waiter can't hold a ticket, as it would have to be served
+	// even after giving up, so it keeps trying for an empty line instead.
+	template <class Clock, class Duration>
+	bool try_lock_until(
+			const std::chrono::time_point<Clock, Duration>& when) {
+		while (when > Clock::now()) {
+			if (try_lock())
+				return true;
+			cpu_relax();
+		}
+		return false; // Time elapsed
+	}
+
+	void unlock() {
+		// Only the holder writes now_serving.
+		now_serving.store(now_serving.load(std::memory_order_relaxed) + 1,
+				  std::memory_order_release);
+	}
+};
+
+}
+#endif
@@ -0,0 +1,173 @@
+//============================================================================
+//                                  libcpp-util
+//                   A simple odds-n-ends library for C++11
+//
+//         Licensed under modified BSD license. See LICENSE for details.
+//============================================================================
+
+#ifndef LIBCPP_UTIL_WAIT_POLICY_H
+#define LIBCPP_UTIL_WAIT_POLICY_H
+
+#include "libcpp-util/smp/futex.h"
+#include "libcpp-util/smp/spinlock.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace cpputil {
+
+// Wait policies decide what a thread does while a condition it can't change
+// itself (say, a queue having space) is false. Each instance guards one such
+// condition:
+//
+//	template <class Pred> void wait(Pred ready);
+//	void notify_one();
+//	void notify_all();
+//
+// wait() returns once ready() has been observed true. The condition is
+// whatever the waker changed before calling notify_*(), which it must do after
+// every change that might make ready() true. Sleeping policies use a
+// Dekker-style handshake with notify_*(): the waiter announces itself and then
+// rechecks ready(), and the waker publishes its change and then checks for
+// waiters, so one of them always sees the other. That also means notify_*()
+// is just a fence and a load when nobody is asleep.
+
+// Sleep on a condition variable. Cheap on CPU, but every wakeup is a trip
+// through the scheduler.
+class condvar_wait_policy {
+private:
+	std::atomic_uint waiters;
+	std::mutex lock;
+	std::condition_variable cv;
+
+	condvar_wait_policy(const condvar_wait_policy&) = delete;
+	condvar_wait_policy& operator=(const condvar_wait_policy&) = delete;
+
+public:
+	condvar_wait_policy() : waiters(0) {}
+
+	template <class Pred>
+	void wait(Pred ready) {
+		if (ready())
+			return;
+		std::unique_lock<std::mutex> l(lock);
+		waiters.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		while (!ready())
+			cv.wait(l);
+		waiters.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	void notify_one() {
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (waiters.load(std::memory_order_relaxed)) {
+			std::lock_guard<std::mutex> l(lock);
+			cv.notify_one();
+		}
+	}
+
+	void notify_all() {
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (waiters.load(std::memory_order_relaxed)) {
+			std::lock_guard<std::mutex> l(lock);
+			cv.notify_all();
+		}
+	}
+};
+
+// Burn the core until the condition holds. Lowest latency, but only sensible
+// when the waiter has a core to itself.
+class spin_wait_policy {
+public:
+	template <class Pred>
+	void wait(Pred ready) {
+		while (!ready())
+			cpu_relax();
+	}
+
+	void notify_one() {}
+	void notify_all() {}
+};
+
+// Spin for a while, then keep yielding the core to anyone else runnable.
+template <unsigned SpinCount = 1000>
+class yield_wait_policy {
+public:
+	template <class Pred>
+	void wait(Pred ready) {
+		for (unsigned i = 0; i < SpinCount; ++i) {
+			if (ready())
+				return;
+			cpu_relax();
+		}
+		while (!ready())
+			std::this_thread::yield();
+	}
+
+	void notify_one() {}
+	void notify_all() {}
+};
+
+// Spin for a while, then park in the kernel on a futex. Wakeups skip the
+// mutex that condvar_wait_policy needs, and notifying with nobody parked
+// never leaves userspace. A Shared policy has no pointers in it and uses
+// process-shared futexes, so it works from memory mapped into several
+// processes.
+template <unsigned SpinCount = 1000, bool Shared = false>
+class futex_wait_policy {
+private:
+	std::atomic<int> generation;
+	std::atomic_uint waiters;
+
+	futex_wait_policy(const futex_wait_policy&) = delete;
+	futex_wait_policy& operator=(const futex_wait_policy&) = delete;
+
+	void wake(int n) {
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (waiters.load(std::memory_order_relaxed)) {
+			generation.fetch_add(1, std::memory_order_release);
+			futex_wake(generation, n, Shared);
+		}
+	}
+
+public:
+	futex_wait_policy() : generation(0), waiters(0) {}
+
+	template <class Pred>
+	void wait(Pred ready) {
+		for (unsigned i = 0; i < SpinCount; ++i) {
+			if (ready())
+				return;
+			cpu_relax();
+		}
+		while (1) {
+			waiters.fetch_add(1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			// Sample the generation before the final check, so a
+			// wakeup in between makes futex_wait() return at once.
+			int gen = generation.load(std::memory_order_acquire);
+			if (ready()) {
+				waiters.fetch_sub(1, std::memory_order_relaxed);
+				return;
+			}
+			futex_wait(generation, gen, Shared);
+			waiters.fetch_sub(1, std::memory_order_relaxed);
+		}
+	}
+
+	void notify_one() {
+		wake(1);
+	}
+
+	void notify_all() {
+		wake(INT_MAX);
+	}
+};
+
+template <unsigned SpinCount = 1000>
+using shared_futex_wait_policy = futex_wait_policy<SpinCount, true>;
+
+}
+#endif